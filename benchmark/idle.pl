@@ -0,0 +1,86 @@
+#!/usr/bin/perl
+
+## writes idle.hlc: spawns 20000 processes that each wait on a
+## message with a handler that has a large body
+## usage: ./idle.pl > idle.hlc
+
+use warnings;
+use strict;
+
+my $cases = 32;
+my $procs = 20000;
+
+print <<'EOF';
+(<bc>closure 0
+  (<bc>check-vars 3)
+  (<bc>spawn))
+(<bc>global-set <common>spawn)
+
+(<bc>closure 0
+  (<bc>check-vars 2)
+  (<bc>recv))
+(<bc>global-set <common>recv)
+
+(<bc>closure 0
+  (<bc>check-vars 3)
+EOF
+
+## one branch per case, so that the body is large
+for my $i (0..$cases - 1) {
+    print <<EOF;
+  (<bc>local 2)
+  (<bc>int $i)
+  (<bc>is)
+  (<bc>if
+    (<bc>local 1)
+    (<bc>closure 0
+      (<bc>check-vars 2)
+      (<bc>local 1)
+      (<bc>local 2)
+      (<bc>int $i)
+      (<bc>i+)
+      (<bc>apply 2))
+    (<bc>continue))
+EOF
+}
+
+print <<EOF;
+  (<bc>local 1)
+  (<bc>lit-nil)
+  (<bc>continue))
+(<bc>global-set handler)
+
+(<bc>closure 0
+  (<bc>global <common>recv)
+  (<bc>global handler)
+  (<bc>k-closure 1
+    (<bc>halt))
+  (<bc>apply 2))
+(<bc>global-set idle)
+
+(<bc>closure 0
+  (<bc>local 2)
+  (<bc>int 1)
+  (<bc>i<)
+  (<bc>if
+    (<bc>lit-t)
+    (<bc>continue))
+  (<bc>global <common>spawn)
+  (<bc>local 1)
+  (<bc>local 2)
+  (<bc>k-closure 2
+    (<bc>global f)
+    (<bc>closure-ref 0)
+    (<bc>closure-ref 1)
+    (<bc>int 1)
+    (<bc>i-)
+    (<bc>apply 3))
+  (<bc>global idle)
+  (<bc>apply 3))
+(<bc>global-set f)
+(<bc>k-closure 0
+  (<bc>local 1)
+  (<bc>halt))
+(<bc>int $procs)
+(<bc>apply 3)
+EOF
@@ -28,6 +28,16 @@ and should only be included once
 #include<boost/scoped_ptr.hpp>
 #include<boost/shared_ptr.hpp>
 
+/*the bodies of the continuations and functions built by
+the reducto, ccc and composeo bytecodes; see Process::impl_read()
+*/
+enum ImplBody {
+	impl_reducto_cont_body,
+	impl_ccc_fn_body,
+	impl_composeo_cont_body,
+	impl_body_count
+};
+
 #ifndef DEFINE_GLOBALS
 
 class SymbolsTable;
@@ -56,6 +66,8 @@ extern Symbol* symbol_binobj;
 extern Symbol* symbol_io;
 extern Symbol* symbol_bool;
 extern Symbol* symbol_call_star;
+/*the globals holding each ImplBody*/
+extern Symbol* symbol_impl_body[impl_body_count];
 
 extern boost::shared_ptr<IOPort> port_stdin;
 extern boost::shared_ptr<IOPort> port_stdout;
@@ -0,0 +1,88 @@
+#ifndef ASMCACHE_H
+#define ASMCACHE_H
+
+#include"objects.hpp"
+#include"heaps.hpp"
+#include"mutexes.hpp"
+
+#include<map>
+#include<list>
+#include<string>
+#include<cstddef>
+#include<stdint.h>
+
+#include<boost/noncopyable.hpp>
+#include<boost/shared_ptr.hpp>
+
+class Process;
+
+/*-----------------------------------------------------------------------------
+Assembly cache
+
+Code built at run time, such as eval'ed macro output, often hands
+the same sequence to <impl>assemble again and again.  The sequence
+is first encoded as a key, which holds its structure and every
+atom in it, and looked up by the hash of that key; on a hit the
+Bytecode assembled the first time is copied into the process,
+which costs a copy of its constants but shares its code.
+
+Only sequences made of conses, symbols, numbers, characters, nil
+and t are cached; anything else is just assembled.  Entries are
+immutable snapshots, as global values are, so they are copied out
+without holding the lock.  Once there are more than `capacity`,
+the least recently used is dropped.
+-----------------------------------------------------------------------------*/
+
+class AssemblyCache : boost::noncopyable {
+private:
+	struct Entry {
+		uint64_t hash;
+		std::string key;
+		boost::shared_ptr<ValueHolder const> code;
+	};
+	/*most recently used first*/
+	typedef std::list<Entry> lru_list;
+	typedef std::multimap<uint64_t, lru_list::iterator> hash_map;
+	lru_list lru;
+	hash_map index;
+	AppMutex m;
+
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+
+	hash_map::iterator find(uint64_t hash, std::string const& key);
+	void evict(void);
+
+public:
+	/*maximum number of entries; 0 disables the cache.  Set at
+	startup only.
+	*/
+	static size_t capacity;
+
+	AssemblyCache(void) : hits(0), misses(0), evictions(0) { }
+
+	/*encodes seq in key; false if it can't be cached*/
+	static bool key_of(Object::ref seq, std::string& key);
+
+	/*if key was assembled before, replaces the stack top with
+	a copy of the Bytecode and returns true
+	*/
+	bool lookup(Process&, std::string const& key);
+	/*remembers the Bytecode on the stack top as assembled
+	from key
+	*/
+	void insert(Process&, std::string const& key);
+
+	struct Metrics {
+		size_t hits;
+		size_t misses;
+		size_t evictions;
+		size_t entries;
+	};
+	Metrics get_metrics(void);
+};
+
+extern AssemblyCache asm_cache;
+
+#endif // ASMCACHE_H
@@ -3,10 +3,8 @@
 
 #include "executors.hpp"
 
-// map opcodes to bytecodes
-extern std::map<Symbol*,_bytecode_label> bytetb; // declared in executors.cpp
-// inverse map for disassembly
-extern std::map<_bytecode_label, Symbol*> inv_bytetb; // declared in executors.cpp
+#include <vector>
+#include <stdint.h>
 
 class AsOp {
 public:
@@ -77,8 +75,20 @@ public:
                                    "<bc>k-closure-reuse") {}
 };
 
+// whether arg is a literal ComplexAs<T> accepts
+template <class T>
+inline bool is_literal(Object::ref arg) {
+  return maybe_type<T>(arg);
+}
+// floats may also be unboxed
+template <>
+inline bool is_literal<Float>(Object::ref arg) {
+  return is_float(arg);
+}
+
 // assemble instructions to push a complex constant on the stack
 // a complex constant is one that resides on the process-local heap
+// (or, for an unboxed float, is kept with the ones that do)
 template <class T>
 class ComplexAs : public AsOp {
 public:
@@ -118,42 +128,183 @@ void DbgInfoAs<S>::assemble(Process & proc) {
 	(*S)(expect_type<Bytecode>(proc.stack.top()), info);
 }
 
+// maps the name or the label of a bytecode to its opcode
+// open addressed and probed linearly; only written during startup, so
+// it is read without a lock
+class OpcodeIndex {
+private:
+  struct Slot {
+    uintptr_t key;
+    size_t op;
+  };
+  std::vector<Slot> slots; // size is a power of 2
+  size_t used;
+
+  static size_t home(uintptr_t key) {
+    // pointers and labels differ mostly in their middle bits
+    return key ^ (key >> 7) ^ (key >> 17);
+  }
+  void grow();
+
+public:
+  static size_t const none = (size_t) -1;
+
+  OpcodeIndex();
+
+  size_t find(uintptr_t key) const {
+    size_t mask = slots.size() - 1;
+    for (size_t i = home(key) & mask; ; i = (i + 1) & mask) {
+      if (slots[i].op == none || slots[i].key == key)
+        return slots[i].op;
+    }
+  }
+  void insert(uintptr_t key, size_t op);
+};
+
 class Assembler {
+public:
+  // functions that evaluate a bytecode taking two arguments from
+  // the stack, for constant folding
+  typedef void (*fold_fn)(Process &, ProcessStack &);
+
+  // everything known of a bytecode, or of a form that assembles to
+  // something else, such as (<bc>if ...)
+  struct Opcode {
+    // NULL for fused bytecodes, which are never read
+    Symbol *name;
+    // NULL_BYTECODE for forms that aren't a single bytecode
+    _bytecode_label label;
+    bytecode_arg_type arg;
+    // assembles the form, if it isn't just the bytecode
+    AsOp *as;
+    // disassembles the bytecode, if it isn't just the form
+    AsOp *disas;
+    // for a fused bytecode, the first bytecode of its run; otherwise
+    // the bytecode itself
+    _bytecode_label original;
+    fold_fn fold;
+  };
+
 private:
-  typedef std::map<Symbol*, AsOp*> sym_op_tbl;
-  typedef std::map<_bytecode_label, AsOp*> lbl_op_tbl;
-  sym_op_tbl tbl;
-  lbl_op_tbl inv_tbl;
+  // indexed by opcode, and both indices below lead into it
+  std::vector<Opcode> ops;
+  OpcodeIndex by_name;
+  OpcodeIndex by_label;
+
+  // the opcode of s or lbl, added if there is none yet
+  Opcode& intern(Symbol *s);
+  Opcode& intern(_bytecode_label lbl);
 
   // extracts a value pointer/immediate object, throwing away the type tag
   static intptr_t simpleVal(Object::ref sa);
+  // the argument of o as stored in a bytecode_t
+  static intptr_t simpleVal(Opcode const& o, Object::ref sa);
 
-  std::map<_bytecode_label, bytecode_arg_type> op_args;
-  // tells the argument type of the given bytecode
-  bytecode_arg_type argType(_bytecode_label lbl);
+  // a run of bytecodes that is executed by a single fused bytecode
+  struct Fusion {
+    _bytecode_label fused;
+    std::vector<_bytecode_label> seq;
+  };
+  // longest runs first
+  std::vector<Fusion> fusions;
+  void regFusion(Fusion const& f);
+
+  // rewrite runs of bytecodes in b into fused bytecodes
+  void fuse(Bytecode *b);
 
 public:
+  // tells if form pushes a constant, and which
+  static bool constValue(Object::ref form, Object::ref & v);
+
+  // the opcode of a name or a label, or OpcodeIndex::none
+  size_t opcode(Symbol *s) const {
+    return by_name.find((uintptr_t) s);
+  }
+  size_t opcode(_bytecode_label lbl) const {
+    return by_label.find((uintptr_t) lbl);
+  }
+  // number of opcodes; each is less than this
+  size_t opcodes() const { return ops.size(); }
+
+  // what is known of a name or a label, or NULL if nothing
+  Opcode const* find(Symbol *s) const {
+    size_t i = opcode(s);
+    return i == OpcodeIndex::none ? NULL : &ops[i];
+  }
+  Opcode const* find(_bytecode_label lbl) const {
+    size_t i = opcode(lbl);
+    return i == OpcodeIndex::none ? NULL : &ops[i];
+  }
+
+  // the bytecode named s; throws if there is none
+  _bytecode_label label(Symbol *s) const;
+  // the name of a bytecode that isn't fused, or NULL
+  Symbol* name(_bytecode_label lbl) const {
+    Opcode const* o = find(lbl);
+    return o ? o->name : NULL;
+  }
+
+  // tells the argument type of the given bytecode
+  bytecode_arg_type argType(_bytecode_label lbl) const {
+    Opcode const* o = find(lbl);
+    return o ? o->arg : ARG_NONE;
+  }
+
+  // the bytecode a (possibly fused) bytecode was assembled from
+  _bytecode_label original(_bytecode_label lbl) const {
+    Opcode const* o = find(lbl);
+    return o ? o->original : lbl;
+  }
+
+  // 0: assemble as written
+  // 1: also fold constants and drop dead branches
+  // 2: also fuse bytecodes
+  size_t opt_level;
+
+  Assembler() : opt_level(2) { }
   ~Assembler() { 
-    for (sym_op_tbl::iterator i = tbl.begin(); i!=tbl.end(); i++)
-      delete i->second;
+    for (size_t i = 0; i < ops.size(); ++i)
+      delete ops[i].as;
   }
 
-  // register opcode as an opcode that accept an argument of the given type
-  void regArg(_bytecode_label lbl, bytecode_arg_type tp);
+  // register s as the name of the bytecode lbl, which accepts an
+  // argument of the given type
+  void regBytecode(Symbol *s, _bytecode_label lbl, bytecode_arg_type tp);
 
   // register a new assembler operation
   template <class T>
   void reg(Symbol* s, _bytecode_label lbl) { 
     T *op = new T();
-    tbl[s] = op;
-    inv_tbl[lbl] = op;
+    intern(s).as = op;
+    if (lbl != NULL_BYTECODE)
+      intern(lbl).disas = op;
   }
 
+  // register fused as executing the run a b [c [d]]
+  // fused reads the arguments of the whole run from the original
+  // bytecodes, which are left in place after it
+  void regFusion(_bytecode_label fused,
+                 _bytecode_label a, _bytecode_label b);
+  void regFusion(_bytecode_label fused,
+                 _bytecode_label a, _bytecode_label b, _bytecode_label c);
+  void regFusion(_bytecode_label fused,
+                 _bytecode_label a, _bytecode_label b, _bytecode_label c,
+                 _bytecode_label d);
+
+  // register f as evaluating the bytecode s on constant arguments
+  void regFold(Symbol *s, fold_fn f) { intern(s).fold = f; }
+
+  // optimize the seq on the stack top, which is modified in place,
+  // in one pass
+  void optimize(Process & proc);
+
   AsOp* get_operation(Symbol *s);
 
   // do the assembly, leave a Bytecode on the stack, expect a sequence on 
   // the stack
   void go(Process & proc); 
+  // the last steps of go(), for a Bytecode built otherwise
+  void finish(Bytecode *b);
   // disassemble a sequence
   // take a Bytecode from the stack, leave a sequence on the stack
   // disassemble form index start to index end (exclusive)
@@ -182,7 +333,8 @@ template <class T>
 void ComplexAs<T>::assemble(Process & proc) {
   proc.stack.pop(); // there should be no sequence
   Object::ref arg = proc.stack.top(); proc.stack.pop();
-  expect_type<T>(arg, "assemble: wrong type for complex argument");
+  if (!is_literal<T>(arg))
+    throw_HlError("assemble: wrong type for complex argument");
   Bytecode *b = expect_type<Bytecode>(proc.stack.top());
   if (Assembler::isComplexConst(arg)) {
     size_t i = b->closeOver(arg);
@@ -0,0 +1,64 @@
+#ifndef BIGINTS_H
+#define BIGINTS_H
+
+#include<vector>
+#include<string>
+#include<cstddef>
+#include<stdint.h>
+
+/*-----------------------------------------------------------------------------
+Arbitrary-precision integers
+
+The arithmetic behind BigInt, on values that live outside of the
+process heaps, so that the operands can't move while the result
+is computed.  A value is a sign and a magnitude, a vector of
+32-bit limbs, least significant first, without zero limbs at the
+top; zero has no limbs and is never negative.
+-----------------------------------------------------------------------------*/
+
+typedef uint32_t limb_t;
+typedef std::vector<limb_t> Limbs;
+
+class BigValue {
+public:
+	bool neg;
+	Limbs mag;
+
+	/*products of two magnitudes both at least this many
+	limbs long are computed with Karatsuba's method
+	*/
+	static size_t const karatsuba_threshold = 32;
+
+	BigValue(void) : neg(0), mag() { }
+	explicit BigValue(intptr_t);
+
+	bool is_zero(void) const { return mag.empty(); }
+	/*true if the value fits in an intptr_t, which is
+	then stored in x
+	*/
+	bool to_intptr(intptr_t& x) const;
+	double to_double(void) const;
+	std::string to_string(void) const;
+	/*parses an optional '-' followed by decimal digits;
+	false if s isn't one
+	*/
+	static bool from_string(std::string const& s, BigValue& r);
+
+	/*negative, zero or positive, as a is less, equal or
+	greater than b
+	*/
+	static int compare(BigValue const& a, BigValue const& b);
+
+	/*r must not be an operand*/
+	static void add(BigValue& r, BigValue const& a, BigValue const& b);
+	static void sub(BigValue& r, BigValue const& a, BigValue const& b);
+	static void mul(BigValue& r, BigValue const& a, BigValue const& b);
+	/*truncating division, as C does for int: q is rounded
+	towards zero, and m has the sign of a.  b must not be
+	zero.
+	*/
+	static void divmod(BigValue& q, BigValue& m,
+		BigValue const& a, BigValue const& b);
+};
+
+#endif // BIGINTS_H
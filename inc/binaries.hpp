@@ -0,0 +1,96 @@
+#ifndef BINARIES_H
+#define BINARIES_H
+
+#include<string>
+#include<vector>
+#include<ostream>
+
+class Process;
+class Bytecode;
+
+/*-----------------------------------------------------------------------------
+Precompiled bytecode (.hlb)
+
+An assembled body and every body it closes over, written so that
+they can be loaded again without reading any conses or running
+the assembler.  Numbers are written seven bits to a byte, the
+lowest first, with signed ones zigzag-encoded; only the bits of a
+double are written as eight bytes, little-endian.
+
+	"HLB1"
+	symbols: u32 count, then each print name as u32 length
+		and bytes
+	bodies: u32 count, then each body, the bodies it closes
+		over before it, and the one to run last:
+		u32 slots, then each slot as a datum, or as 'b' and
+		the u32 index of an earlier body
+		the debug name, file and line, as datums
+		u32 length, then each bytecode as the u32 symbol of
+		its name and its signed argument, which for a symbol
+		argument, or an executor, is a u32 symbol instead
+
+A datum is 'n' (nil), 't' (t), 'i' and a signed smallint, 'f' and
+the bits of a double, 's' and a u32 symbol, 'C' and a u32 character,
+'"' and a UTF-8 string, 'I' and the decimal digits of a BigInt,
+both stored as a print name is, or 'c' and two datums.
+
+Bytecodes are written as they were before being fused, and are
+fused again when loaded, as the current --opt-level says.
+-----------------------------------------------------------------------------*/
+
+/*true if the contents start as a .hlb file does*/
+bool is_hlb(std::vector<char> const&);
+
+/*writes b, assembled, and the bodies it closes over*/
+void write_hlb(std::ostream&, Bytecode& b);
+
+/*loads the contents of a .hlb file, leaving the Bytecode
+to run on the stack
+*/
+void load_hlb(Process&, std::vector<char> const&);
+
+/*-----------------------------------------------------------------------------
+Boot images
+
+The values of every bound global, saved after the boot files have
+run, so that a later run can start from them without running the
+boot files again.  An image is laid out as a .hlb file, starting
+with "HLI1" instead, and with no body to run; after the bodies
+come the globals:
+
+	u32 count, then each global:
+		the u32 symbol it is bound to
+		u32 count, then the kind of each of its objects:
+			'c' a cons, 'k' and the u32 size of a closure,
+			'a' and the u32 size of an array, 'h' a table
+			or 'g' a tagged object
+		the contents of each object that isn't a table:
+			the car and cdr of a cons, the body and then
+			each closed-over value of a closure, each
+			entry of an array, the type and rep of a
+			tagged object
+		the contents of each table: u32 count, then each
+			key and its value
+		its value
+
+Each is a value: 'o' and the u32 index of one of the global's
+objects, 'b' and the u32 index of a body, or a datum.  Objects can
+thus be shared and cyclic within a global; the objects of
+different globals are never shared, as they aren't in a running
+VM either.
+
+The image holds no addresses: bytecodes are named, and the
+executors and the JIT are set up from them as with a .hlb file,
+so an image stays valid across builds with the same bytecodes.
+Globals bound to values that can't be saved, such as ports and
+processes, are reported and left out.
+-----------------------------------------------------------------------------*/
+
+/*writes every bound global to the image file*/
+void save_image(std::string const& file);
+
+/*maps the image file, and binds the globals saved in it*/
+void load_image(Process&, std::string const& file);
+
+#endif // BINARIES_H
+
@@ -247,102 +247,114 @@ inline void bytecode_variadic(Process& proc, ProcessStack& stack, int N){
 // Math
 
 /*integer math*/
+
+enum IntegerOp {
+  integer_plus, integer_minus, integer_mul,
+  integer_div, integer_mod, integer_less
+};
+
+/*The integer operations when an argument or the result is not
+a smallint: the smallint cases below are inline, and overflow
+to here, which promotes to BigInt.  err is thrown if an
+argument isn't an integer at all.
+*/
+void bytecode_integer_op(Process & p, ProcessStack & stack,
+    IntegerOp op, char const* err);
+
 inline void bytecode_iplus(Process & p, ProcessStack & stack) {
   Object::ref a = stack.top(2);
-  Object::ref b = stack.top(); stack.pop();
-  if (is_a<int>(a)) {
-    if (is_a<int>(b)) {
-      stack.top() = 
-        Object::from_a_scaled_int(Object::to_a_scaled_int(a) +  
-                                  Object::to_a_scaled_int(b));
-      return;
-    }
+  Object::ref b = stack.top();
+  int r;
+  if (is_a<int>(a) && is_a<int>(b) &&
+      likely(!add_overflow(as_a<int>(a), as_a<int>(b), &r) &&
+             is_smallint(r))) {
+    stack.pop();
+    stack.top() = Object::to_ref(r);
+    return;
   }
-  throw_HlError("'i+ expected two integers");
+  bytecode_integer_op(p, stack, integer_plus, "'i+ expected two integers");
 }
 
 inline void bytecode_iminus(Process & p, ProcessStack & stack) {
   Object::ref a = stack.top(2);
-  Object::ref b = stack.top(); stack.pop();
-  if (is_a<int>(a)) {
-    if (is_a<int>(b)) {
-      stack.top() = 
-        Object::from_a_scaled_int(Object::to_a_scaled_int(a) -  
-                                  Object::to_a_scaled_int(b));
-      return;
-    }
+  Object::ref b = stack.top();
+  int r;
+  if (is_a<int>(a) && is_a<int>(b) &&
+      likely(!sub_overflow(as_a<int>(a), as_a<int>(b), &r) &&
+             is_smallint(r))) {
+    stack.pop();
+    stack.top() = Object::to_ref(r);
+    return;
   }
-  throw_HlError("'i- expected two integers");
+  bytecode_integer_op(p, stack, integer_minus, "'i- expected two integers");
 }
 
 inline void bytecode_imul(Process & p, ProcessStack & stack) {
   Object::ref a = stack.top(2);
-  Object::ref b = stack.top(); stack.pop();
-  if (is_a<int>(a)) {
-    if (is_a<int>(b)) {
-      stack.top() = Object::to_ref(as_a<int>(a) * as_a<int>(b));
-      return;
-    }
+  Object::ref b = stack.top();
+  int r;
+  if (is_a<int>(a) && is_a<int>(b) &&
+      likely(!mul_overflow(as_a<int>(a), as_a<int>(b), &r) &&
+             is_smallint(r))) {
+    stack.pop();
+    stack.top() = Object::to_ref(r);
+    return;
   }
-  throw_HlError("'i* expected two integers");
+  bytecode_integer_op(p, stack, integer_mul, "'i* expected two integers");
 }
 
 inline void bytecode_idiv(Process & p, ProcessStack & stack) {
   Object::ref a = stack.top(2);
-  Object::ref b = stack.top(); stack.pop();
-  if (is_a<int>(a)) {
-    if (is_a<int>(b)) {
-      int x = as_a<int>(b);
-      if (x == 0)
-        throw_HlError("division by zero");
+  Object::ref b = stack.top();
+  if (is_a<int>(a) && is_a<int>(b)) {
+    int x = as_a<int>(b);
+    if (x == 0)
+      throw_HlError("division by zero");
+    /*the only overflow: the smallest int by -1*/
+    if (x != -1) {
+      stack.pop();
       stack.top() = Object::to_ref(as_a<int>(a) / x);
       return;
     }
   }
-  throw_HlError("'i/ expected two integers");
+  bytecode_integer_op(p, stack, integer_div, "'i/ expected two integers");
 }
 
 inline void bytecode_imod(Process & p, ProcessStack & stack) {
   Object::ref a = stack.top(2);
-  Object::ref b = stack.top(); stack.pop();
-  if (is_a<int>(a)) {
-    if (is_a<int>(b)) {
-      int x = as_a<int>(b);
-      if (x == 0)
-        throw_HlError("division by zero");
-      stack.top() = Object::to_ref(as_a<int>(a) % x);
-      return;
-    }
+  Object::ref b = stack.top();
+  if (is_a<int>(a) && is_a<int>(b)) {
+    int x = as_a<int>(b);
+    if (x == 0)
+      throw_HlError("division by zero");
+    stack.pop();
+    /*x % -1 is always 0, but traps for the smallest int*/
+    stack.top() = Object::to_ref(x == -1 ? 0 : as_a<int>(a) % x);
+    return;
   }
-  throw_HlError("'imod expects two integers");
+  bytecode_integer_op(p, stack, integer_mod, "'imod expects two integers");
 }
 
 inline void bytecode_iless(Process & p, ProcessStack & stack) {
   Object::ref a = stack.top(2);
-  Object::ref b = stack.top(); stack.pop();
-  if (is_a<int>(a)) {
-    if (is_a<int>(b)) {
-      stack.top() =
-        as_a<int>(a) < as_a<int>(b) ?          Object::t() :
-        /*otherwise*/                          Object::nil() ;
-      return;
-    }
+  Object::ref b = stack.top();
+  if (is_a<int>(a) && is_a<int>(b)) {
+    stack.pop();
+    stack.top() =
+      as_a<int>(a) < as_a<int>(b) ?          Object::t() :
+      /*otherwise*/                          Object::nil() ;
+    return;
   }
-  throw_HlError("'i< expects two integers");
+  bytecode_integer_op(p, stack, integer_less, "'i< expects two integers");
 }
 
 /*float math*/
 inline void bytecode_fplus(Process & p, ProcessStack & stack) {
   Object::ref a = stack.top(2);
   Object::ref b = stack.top(); stack.pop();
-  if (maybe_type<Float>(a)) {
-    if (maybe_type<Float>(b)) {
-      Float* fa = known_type<Float>(a);
-      Float* fb = known_type<Float>(b);
-      stack.top() = 
-        Object::to_ref(Float::mk(p, fa->get() + fb->get()));;
-      return;
-    }
+  if (is_float(a) && is_float(b)) {
+    stack.top() = Float::mk(p, float_value(a) + float_value(b));
+    return;
   }
   throw_HlError("'f+ expected two floats");
 }
@@ -350,14 +362,9 @@ inline void bytecode_fplus(Process & p, ProcessStack & stack) {
 inline void bytecode_fminus(Process & p, ProcessStack & stack) {
   Object::ref a = stack.top(2);
   Object::ref b = stack.top(); stack.pop();
-  if (maybe_type<Float>(a)) {
-    if (maybe_type<Float>(b)) {
-      Float* fa = known_type<Float>(a);
-      Float* fb = known_type<Float>(b);
-      stack.top() = 
-        Object::to_ref(Float::mk(p, fa->get() - fb->get()));;
-      return;
-    }
+  if (is_float(a) && is_float(b)) {
+    stack.top() = Float::mk(p, float_value(a) - float_value(b));
+    return;
   }
   throw_HlError("'f- expected two floats");
 }
@@ -365,14 +372,9 @@ inline void bytecode_fminus(Process & p, ProcessStack & stack) {
 inline void bytecode_fmul(Process & p, ProcessStack & stack) {
   Object::ref a = stack.top(2);
   Object::ref b = stack.top(); stack.pop();
-  if (maybe_type<Float>(a)) {
-    if (maybe_type<Float>(b)) {
-      Float* fa = known_type<Float>(a);
-      Float* fb = known_type<Float>(b);
-      stack.top() = 
-        Object::to_ref(Float::mk(p, fa->get() * fb->get()));;
-      return;
-    }
+  if (is_float(a) && is_float(b)) {
+    stack.top() = Float::mk(p, float_value(a) * float_value(b));
+    return;
   }
   throw_HlError("'f* expected two floats");
 }
@@ -380,16 +382,12 @@ inline void bytecode_fmul(Process & p, ProcessStack & stack) {
 inline void bytecode_fdiv(Process & p, ProcessStack & stack) {
   Object::ref a = stack.top(2);
   Object::ref b = stack.top(); stack.pop();
-  if (maybe_type<Float>(a)) {
-    if (maybe_type<Float>(b)) {
-      Float* fa = known_type<Float>(a);
-      Float* fb = known_type<Float>(b);
-      if(fb->get() == 0.0)
-        throw_HlError("division by zero");
-      stack.top() = 
-        Object::to_ref(Float::mk(p, fa->get() / fb->get()));;
-      return;
-    }
+  if (is_float(a) && is_float(b)) {
+    double y = float_value(b);
+    if (y == 0.0)
+      throw_HlError("division by zero");
+    stack.top() = Float::mk(p, float_value(a) / y);
+    return;
   }
   throw_HlError("'f/ expected two floats");
 }
@@ -397,15 +395,11 @@ inline void bytecode_fdiv(Process & p, ProcessStack & stack) {
 inline void bytecode_fless(Process & p, ProcessStack & stack) {
   Object::ref a = stack.top(2);
   Object::ref b = stack.top(); stack.pop();
-  if (maybe_type<Float>(a)) {
-    if (maybe_type<Float>(b)) {
-      Float* fa = known_type<Float>(a);
-      Float* fb = known_type<Float>(b);
-      stack.top() =
-        fa->get() < fb->get() ?                Object::t() :
-        /*otherwise*/                          Object::nil() ;
-      return;
-    }
+  if (is_float(a) && is_float(b)) {
+    stack.top() =
+      float_value(a) < float_value(b) ?      Object::t() :
+      /*otherwise*/                          Object::nil() ;
+    return;
   }
   throw_HlError("'f< expects two floats");
 }
@@ -194,13 +194,40 @@ DECLARE_BYTECODES
 	A_BYTECODE(fmul)
 	A_BYTECODE(fdiv)
 	A_BYTECODE(fless)
+	/*fused bytecodes: never read from source, only
+	written by Assembler::fuse()
+	*/
+	A_BYTECODE(check_vars_local)
+	A_BYTECODE(global_local)
+	A_BYTECODE(global_local_apply)
+	A_BYTECODE(local_local)
+	A_BYTECODE(local_apply)
+	A_BYTECODE(local_local_iplus)
+	A_BYTECODE(local_int_iplus)
+	A_BYTECODE(local_int_iminus)
+	A_BYTECODE(int_local_iless_jmp_nil)
+	A_BYTECODE(local_int_iless_jmp_nil)
 	A_BYTECODE(the_null_bytecode)
 END_DECLARE_BYTECODES
 
+/*counts the bytecode when profiling; prof is a local of execute().
+Only compiled in with BYTECODE_PROFILE (configure
+--enable-bytecode-profile), so that other builds don't test
+for it on every bytecode.
+*/
+#ifdef BYTECODE_PROFILE
+#define PROFILE_BYTECODE(x) if(unlikely(prof)) prof->hit(BYTECODE_ENUM(x), #x);
+#else
+#define PROFILE_BYTECODE(x)
+#endif
+
 #ifdef BYTECODE_DEBUG
 #include<iostream>
-#define COLON_POST_BYTECODE_LABEL(x) : \
+#define COLON_POST_BYTECODE_LABEL(x) : PROFILE_BYTECODE(x) \
 	std::cerr << "bytecode " #x << std::endl; PASTE_SYMBOLS(post_label_b_, x)
+#elif defined(BYTECODE_PROFILE)
+#define COLON_POST_BYTECODE_LABEL(x) : PROFILE_BYTECODE(x) \
+	PASTE_SYMBOLS(post_label_b_, x)
 #else
 #define COLON_POST_BYTECODE_LABEL(x)
 #endif
@@ -210,8 +237,8 @@ END_DECLARE_BYTECODES
 // use indirect goto when using GCC
 
 typedef void* _bytecode_label;
-#define DISPATCH_BYTECODES \
-        bytecode_t *pc = known_type<Bytecode>(known_type<Closure>(stack[0])->code())->getCode();\
+#define DISPATCH_BYTECODES_AT(start) \
+        bytecode_t *pc = known_type<Bytecode>(known_type<Closure>(stack[0])->code())->getCode() + (start);\
 	goto *(pc->op);
 #define NEXT_BYTECODE goto *((++pc)->op)
 #define BYTECODE(x) BYTECODE_ENUM(x); PASTE_SYMBOLS(label_b_, x) COLON_POST_BYTECODE_LABEL(x)
@@ -219,13 +246,18 @@ typedef void* _bytecode_label;
 
 #define NULL_BYTECODE NULL
 
+// native code for hot bytecodes, see jit.hpp
+#if defined(__x86_64__) && !defined(NO_JIT)
+#define HAVE_JIT
+#endif
+
 #else // __GNUC__
 
 // use an enum when using standard C
 
 typedef enum _e_bytecode_label _bytecode_label;
-#define DISPATCH_BYTECODES \
-	bytecode_t *pc = known_type<Bytecode>(known_type<Closure>(stack[0])->code())->getCode();\
+#define DISPATCH_BYTECODES_AT(start) \
+	bytecode_t *pc = known_type<Bytecode>(known_type<Closure>(stack[0])->code())->getCode() + (start);\
 	the_dispatch_bytecodes_label:\
 	switch(pc->op)
 #define NEXT_BYTECODE {pc++; goto the_dispatch_bytecodes_label;}
@@ -236,10 +268,13 @@ typedef enum _e_bytecode_label _bytecode_label;
 
 #endif // __GNUC__
 
+#define DISPATCH_BYTECODES DISPATCH_BYTECODES_AT(0)
+
 class Process;
 class ProcessStack;
 
 class Executor;
+class JitCode;
 
 class ExecutorTable : public std::map<Symbol*, Executor*> {
 public:
@@ -254,12 +289,17 @@ class Executor {
 private:
   // table of available executors
   static ExecutorTable tbl;
+  // the name it is registered under
+  Symbol *name;
 public:
+  Executor() : name(NULL) {}
   // register an executor in the system
   // no locks: executors should be registered only during startup
   static void reg(Symbol *s, Executor *e) {
+    e->name = s;
     tbl[s] = e;
   }
+  Symbol* getName() const { return name; }
   // no locks: tbl stucture is immutable after initialization
   static Executor* findExecutor(Symbol *s) {
     std::map<Symbol*,Executor*>::iterator it = tbl.find(s);
@@ -291,7 +331,9 @@ struct bytecode_t {
 };
 
 // type of bytecode_t::val
-enum bytecode_arg_type { ARG_NONE, ARG_INT, ARG_SYMBOL };
+// an ARG_EXECUTOR is written as the name of an Executor, which the
+// assembler looks up and stores as an Executor*
+enum bytecode_arg_type { ARG_NONE, ARG_INT, ARG_SYMBOL, ARG_EXECUTOR };
 
 // a bytecode object contains a table of complex constants such as gensyms
 class Bytecode : public GenericDerivedVariadic<Bytecode> {
@@ -306,10 +348,22 @@ private:
 	Object::ref file;
 	Object::ref line;
 
+#ifdef HAVE_JIT
+	// native code for the body, once it gets hot.  A body in the
+	// code space is run by every worker, so it is published as
+	// native_code only once complete, and read without locking.
+	boost::shared_ptr<JitCode> native;
+	JitCode* volatile native_code;
+	size_t calls;
+#endif
+
 public:
   Bytecode(size_t sz) 
     : GenericDerivedVariadic<Bytecode>(sz), codeSize(0), nextCode(0), 
       nextPos(0), name(Object::nil()), file(Object::nil()), line(Object::nil())
+#ifdef HAVE_JIT
+      , native_code(0), calls(0)
+#endif
 	{}
   virtual ~Bytecode() {}
 
@@ -325,9 +379,22 @@ public:
   }
 
   bytecode_t* getCode() { return code.get(); }
+  // keeps the code alive even after this Bytecode is collected
+  boost::shared_array<bytecode_t> const& getCodeArray() const { return code; }
 
   size_t getLen() const { return nextCode; }
 
+#ifdef HAVE_JIT
+	JitCode* getNative() { return native_code; }
+	// attaches n, unless another worker attached native code
+	// first; returns the code now attached
+	JitCode* setNative(boost::shared_ptr<JitCode> const& n);
+	// count a call to the body; true on the call that makes it hot.
+	// Workers sharing the body may race on the count, which at
+	// worst compiles it twice.
+	bool heat(size_t threshold) { return ++calls == threshold; }
+#endif
+
   // close a complex constants
   size_t closeOver(Object::ref obj) {
     if (nextPos >= size())
@@ -338,6 +405,10 @@ public:
 
   // add a bytecode at the end of the sequence
   void push(bytecode_t b);
+  // once the code is complete: move it into a block of exactly its
+  // length, starting on a cache line.  Copies of the Bytecode share
+  // the block.
+  void finalize();
   void push(_bytecode_label op, intptr_t val);
   void push(Symbol *s, intptr_t val);
   void push(const char *s, intptr_t val);
@@ -373,10 +444,16 @@ public:
 	static void set_file(Bytecode *b, Object::ref f) {
 		b->file = f;
 	}
+	Object::ref get_file(void) const {
+		return file;
+	}
 
 	static void set_line(Bytecode *b, Object::ref l) {
 		b->line = l;
 	}
+	Object::ref get_line(void) const {
+		return line;
+	}
 
 };
 
@@ -3,15 +3,20 @@
 
 #include"objects.hpp"
 #include"generics.hpp"
+#include"mutexes.hpp"
 
 #include<cstring>
 #include<utility>
+#include<vector>
+#include<map>
+#include<csignal>
 
 #include<boost/scoped_ptr.hpp>
 #include<boost/noncopyable.hpp>
 
 class Generic;
 class ValueHolder;
+class HlPid;
 
 void throw_DeallocError(void*);
 
@@ -60,6 +65,12 @@ private:
 	void* lifoallocpt;
 	size_t prev_alloc;
 	size_t max;
+
+	/*the HlPid objects allocated in this semispace, so that
+	process-level GC can find them without walking every
+	object.  HlPid objects are never lifo-allocated.
+	*/
+	std::vector<HlPid*> pids;
 public:
 	explicit Semispace(size_t);
 	~Semispace();
@@ -83,14 +94,31 @@ public:
 	inline bool can_fit(size_t sz) const {
 		return sz <= free();
 	}
+	inline bool contains(void const* p) const {
+		return ((char const*) p) >= ((char const*) mem) &&
+			((char const*) p) < ((char const*) mem) + max;
+	}
+
+	/*called on each object newly constructed in this
+	semispace; only HlPid objects are actually recorded
+	*/
+	template<class T>
+	inline void track(T*) { }
 
 	void traverse_objects(HeapTraverser*) const;
+	void traverse_pids(HeapTraverser*) const;
 
 	void clone(boost::scoped_ptr<Semispace>&, Generic*&) const;
 
 	friend class Heap;
+	friend class CodeSpace;
 };
 
+template<>
+inline void Semispace::track<HlPid>(HlPid* pp) {
+	pids.push_back(pp);
+}
+
 /*-----------------------------------------------------------------------------
 ValueHolders
 -----------------------------------------------------------------------------*/
@@ -114,6 +142,12 @@ public:
 	*/
 	~ValueHolderRef();
 	void reset(ValueHolder* np = 0);
+	/*gives up ownership of the held ValueHolder*/
+	ValueHolder* release(void) {
+		ValueHolder* rv = p;
+		p = 0;
+		return rv;
+	}
 	void swap(ValueHolderRef& n) {
 		ValueHolder* tmp = p;
 		p = n.p;
@@ -159,8 +193,13 @@ public:
 	void clone(ValueHolderRef&) const;
 
 	void traverse_objects(HeapTraverser*) const;
+	void traverse_pids(HeapTraverser*) const;
 
-	static void copy_object(ValueHolderRef&, Object::ref);
+	/*if share_code, bodies that can be shared are first moved
+	to the code space, and the copy refers to them there
+	*/
+	static void copy_object(ValueHolderRef&, Object::ref,
+		bool share_code = false);
 
 	friend class ValueHolderRef;
 	friend class LockedValueHolderRef;
@@ -207,6 +246,68 @@ inline Object::ref ValueHolderRef::value(void) {
 	else	return Object::nil();
 }
 
+/*-----------------------------------------------------------------------------
+Code space
+
+A single semispace, shared by every process, for bodies that are
+bound to globals.  A body and the numbers it holds can't be
+changed once assembled, so when a global is set they are moved
+here once, and every process that reads the global refers to them
+here instead of getting its own copy; only the closures and other
+mutable objects are still copied.
+
+Objects here are never collected, nor copied by a GC, a message
+send or a global read: anything that walks the objects of a
+process stops at them.  The space is never compacted either, so
+bodies of globals that are set again stay until the VM exits.
+When it is full, bodies are copied with the global as before; a
+warning is printed the first time, and the bodies turned away are
+counted in the scheduler metrics.
+
+The semispace is allocated but not touched until used, so its
+size costs address space, not memory.
+-----------------------------------------------------------------------------*/
+
+class CodeSpace : boost::noncopyable {
+private:
+	boost::scoped_ptr<Semispace> sp;
+	/*bounds of sp, checked without locking*/
+	char const* lo;
+	char const* hi;
+	AppMutex m;
+	/*bodies that could have been shared, but didn't fit*/
+	size_t unshared_bodies;
+public:
+	/*large enough for the bodies of a big program*/
+	static size_t const default_size = 64 * 1024 * 1024;
+
+	/*empty, sharing nothing, until reset*/
+	CodeSpace(void) : lo(0), hi(0), m(), unshared_bodies(0) { }
+
+	/*replaces the space with an empty one of the given size,
+	0 to share nothing.  Only at startup, before anything has
+	been moved in.
+	*/
+	void reset(size_t);
+
+	inline bool contains(Generic const* gp) const {
+		return ((char const*) gp) >= lo && ((char const*) gp) < hi;
+	}
+
+	/*moves each body reachable from gp that can be shared,
+	and isn't here already, into the space, and maps each
+	moved object to its copy in moved.  The originals are left
+	as they are.
+	*/
+	void share(Generic* gp, std::map<Generic*, Generic*>& moved);
+
+	size_t used(void);
+	size_t unshared(void);
+};
+
+/*hlvma sizes it once its options are read*/
+extern CodeSpace code_space;
+
 /*-----------------------------------------------------------------------------
 Heaps
 -----------------------------------------------------------------------------*/
@@ -233,6 +334,11 @@ protected:
 
 public:
 	ValueHolderRef other_spaces;
+	/*non-zero while GC() moves objects around; read by the
+	stack sampler's signal handler, which must not walk the
+	heap then
+	*/
+	volatile sig_atomic_t collecting;
 	template<class T>
 	inline T* create(void) {
 		/*compile-time checking that T inherits from Generic*/
@@ -244,6 +350,7 @@ public:
 		void* pt = main->alloc(sz);
 		try {
 			new(pt) T();
+			main->track((T*) pt);
 			return (T*) pt;
 		} catch(...) {
 			main->dealloc(pt);
@@ -307,12 +414,22 @@ public:
 	}
 
 	void traverse_objects(HeapTraverser*) const;
+	void traverse_pids(HeapTraverser*) const;
+
+	/*number of bytes used in all semispaces of this heap*/
+	size_t used_total(void) const {
+		size_t total = main ? main->used() : 0;
+		if(!other_spaces.empty()) {
+			total += other_spaces->used_total();
+		}
+		return total;
+	}
 
 	/*clears other_spaces if it's already too deep*/
 	void maybe_clear_other_spaces(void);
 
 	explicit Heap(size_t initsize = 8 * sizeof(Object::ref))
-		: main(new Semispace(initsize)), tight(1) { }
+		: main(new Semispace(initsize)), tight(1), collecting(0) { }
         virtual ~Heap() {}
 };
 
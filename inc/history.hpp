@@ -3,10 +3,9 @@
 
 #include"objects.hpp"
 
-#define BOOST_CB_DISABLE_DEBUG
+#include <cstddef>
 
-#include <boost/circular_buffer.hpp>
-#include <vector>
+#include <boost/scoped_ptr.hpp>
 
 class Process;
 class ProcessStack;
@@ -16,28 +15,83 @@ class GenericTraverser;
  * Wrapper around Process, converts history information
  */
 class History {
-private:
-	ProcessStack& stack;
-
-	History(void); //disallowed!
-	History(ProcessStack& nstack) : stack(nstack) { }
-
 public:
-	typedef std::vector<Object::ref> Item;
-	class InnerRing : public boost::circular_buffer<Item> {
+	enum Mode {
+		/*record nothing; backtraces are empty*/
+		history_off,
+		/*record one of every sample_period calls*/
+		history_sampled,
+		/*record every call*/
+		history_full
+	};
+	/*set at startup only*/
+	static Mode mode;
+	static size_t sample_period;
+
+	/*The most recent function calls of a process, newest
+	first.  Each entry remembers the continuation it was
+	called with, so that a backtrace can be built by walking
+	the chain of continuations.  Entries are dropped when
+	their continuation is called (the calls have returned)
+	or released.  Fixed size, and allocated on the first call
+	a process records, so recording a call never allocates
+	after that, and processes that record nothing, such as all
+	of them with --history off, don't carry one.
+	*/
+	class Ring {
 	public:
-		static const size_t breadth = 32;  // TODO: get size from user
-		InnerRing(void) : boost::circular_buffer<Item>(breadth) { }
-		void repeat_set_capacity(void) {
-			set_capacity(breadth);
+		static const size_t breadth = 32;
+		/*arguments after this many are not recorded*/
+		static const size_t max_args = 4;
+		struct Entry {
+			/*nil if the entry is unused*/
+			Object::ref owner;
+			Object::ref fn;
+			size_t nargs;
+			Object::ref args[max_args];
+		};
+	private:
+		Entry entries[breadth];
+		/*index of the newest entry*/
+		size_t newest;
+		/*number of entries whose owner isn't nil*/
+		size_t used;
+		/*calls left until the next one is sampled*/
+		size_t countdown;
+	public:
+		Ring(void);
+		void record(ProcessStack&);
+		/*drops all entries made under the continuation k*/
+		void forget(Object::ref k) {
+			if(used == 0) return;
+			for(size_t i = 0; i < breadth; ++i) {
+				if(entries[i].owner == k) {
+					entries[i].owner = Object::nil();
+					--used;
+				}
+			}
 		}
 		void traverse_references(GenericTraverser*);
+		friend class History;
 	};
 
+private:
+	ProcessStack& stack;
+	boost::scoped_ptr<Ring>& ring;
+
+	History(void); //disallowed!
+	History(ProcessStack& nstack, boost::scoped_ptr<Ring>& nring)
+		: stack(nstack), ring(nring) { }
+
+public:
 	// push a list of the last functions called in the process stack
 	void to_list(Process & proc);
 	// called at each entry of a function
 	void entry(void);
+	// called when the continuation closure k is released
+	void release(Object::ref k) {
+		if(ring) ring->forget(k);
+	}
 
 	friend class Process;
 };
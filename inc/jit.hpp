@@ -0,0 +1,113 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include"executors.hpp"
+
+#ifdef HAVE_JIT
+
+#include"processes.hpp"
+
+#include<vector>
+#include<cstddef>
+#include<stdint.h>
+
+#include<boost/noncopyable.hpp>
+
+/*-----------------------------------------------------------------------------
+Template JIT
+
+Once a Bytecode has been called Jit::threshold times, its
+body is compiled to x86-64 machine code by concatenating one
+template per bytecode.  The templates keep the stack pointers
+in registers, push and pop directly, and do smallint
+arithmetic inline.  Bytecodes without a template (most of
+those that allocate, or may trigger a GC) are left to the
+interpreter: the native code returns the index of the first
+bytecode it can't handle, and the interpreter continues the
+body from there.  A template whose arguments are not what it
+expects (e.g. a non-smallint for i+, or an overflow) does the
+same, leaving the stack as it found it, so that the
+interpreter runs the bytecode again and reports any error.
+-----------------------------------------------------------------------------*/
+
+class JitCode : boost::noncopyable {
+private:
+	typedef intptr_t (*entry_fn)(ProcessStack*, Process*);
+	/*mmap'ed, executable*/
+	void* mem;
+	size_t mem_size;
+	entry_fn entry;
+	/*most entries the native code may push*/
+	size_t depth;
+
+	JitCode(void); // disallowed!
+	JitCode(void* nmem, size_t nmem_size, size_t ndepth);
+
+public:
+	/*returned by run() if the closure on the stack has
+	to be called
+	*/
+	static intptr_t const call = -1;
+
+	/*runs the native code of the current closure, returning
+	call or the index of the bytecode to continue at
+	*/
+	intptr_t run(Process& proc) {
+		proc.stack.reserve(depth);
+		return entry(&proc.stack, &proc);
+	}
+
+	~JitCode();
+
+	friend class Jit;
+};
+
+/*what a bytecode is compiled to*/
+enum JitTemplate {
+	/*no template: return to the interpreter*/
+	jit_none,
+	jit_apply,
+	jit_check_vars,
+	jit_closure_ref,
+	jit_continue,
+	jit_continue_local,
+	jit_global,
+	jit_iless,
+	jit_iminus,
+	jit_int,
+	jit_iplus,
+	jit_jmp_nil,
+	jit_lit_nil,
+	jit_lit_t,
+	jit_local
+};
+
+class Jit {
+private:
+	/*indexed by the opcode of the bytecode*/
+	std::vector<JitTemplate> templates;
+	JitTemplate templateOf(_bytecode_label lbl);
+
+public:
+	/*number of calls after which a body is compiled; 0
+	never compiles.  Set at startup only.
+	*/
+	static size_t threshold;
+
+	/*register the template for a bytecode; only during
+	startup
+	*/
+	void reg(_bytecode_label lbl, JitTemplate t);
+
+	/*compile the body of b and attach the native code to it.
+	Returns NULL, and leaves b alone, if no native code
+	would run (e.g. the first bytecode has no template).
+	*/
+	JitCode* compile(Bytecode& b);
+};
+
+extern Jit jit;
+
+#endif // HAVE_JIT
+
+#endif // JIT_H
@@ -42,6 +42,41 @@ public:
 	}
 };
 
+/*-----------------------------------------------------------------------------
+Relaxed counter
+-----------------------------------------------------------------------------*/
+/*A counter that one thread at a time changes, and that any
+thread may read without a lock.  A read may be slightly out
+of date, and orders nothing else.
+*/
+template<class T>
+class RelaxedCounter : boost::noncopyable {
+private:
+	T num;
+public:
+	RelaxedCounter(T nnum = 0) : num(nnum) { }
+	T load(void) const {
+		#ifndef single_threaded
+			return __atomic_load_n(&num, __ATOMIC_RELAXED);
+		#else
+			return num;
+		#endif
+	}
+	void store(T nnum) {
+		#ifndef single_threaded
+			__atomic_store_n(&num, nnum, __ATOMIC_RELAXED);
+		#else
+			num = nnum;
+		#endif
+	}
+	/*only the thread that changes the counter may call
+	these
+	*/
+	void operator+=(T d) { store(num + d); }
+	void operator++(void) { store(num + 1); }
+	void operator--(void) { store(num - 1); }
+};
+
 /*-----------------------------------------------------------------------------
 Atomic Pointer to ValueHolder
 -----------------------------------------------------------------------------*/
@@ -17,6 +17,8 @@ Usage:
 #include"unichars.hpp"
 #include"workarounds.hpp"
 
+#include<cstring>
+
 class Generic;
 class Symbol;
 class Cons;
@@ -45,6 +47,8 @@ Declare
 
 	static inline ref from_a_scaled_int(int);
 	static inline int to_a_scaled_int(ref);
+
+	static inline bool fits_unboxed(double);
 }
 
 void throw_TypeError(Object::ref, char const*);
@@ -63,7 +67,8 @@ namespace Object {
 Configuration
 -----------------------------------------------------------------------------*/
 
-	static const unsigned char tag_bits = 2;// can bump up to 3 maybe...
+	/*heap objects and symbols must be aligned to 1 << tag_bits*/
+	static const unsigned char tag_bits = 3;
 
 	template<> struct tag_traits<int> {
 		static const tag_type tag = 0x1;
@@ -77,6 +82,10 @@ Configuration
 	template<> struct tag_traits<UnicodeChar> {
 		static const tag_type tag = 0x3;
 	};
+	/*unboxed floats; see fits_unboxed()*/
+	template<> struct tag_traits<double> {
+		static const tag_type tag = 0x4;
+	};
 
 
 /*-----------------------------------------------------------------------------
@@ -103,6 +112,43 @@ Provided information
 	/*value for "t"*/
 	static const intptr_t t_value = ~((intptr_t) tag_mask);
 
+/*-----------------------------------------------------------------------------
+Unboxed floats
+
+As in the 64-bit Spur VM, a double is stored in a ref without
+losing any bits when its exponent is in the 8-bit range around
+1 (magnitudes from about 1e-38 to 1e38), or when it is zero: the
+bits are rotated left by one so that the sign is at the bottom,
+the exponent is rebased, and the three top bits, which are then
+zero, make room for the tag.  Other floats, and all floats where
+refs can't hold 64 bits, are boxed in Float objects.
+-----------------------------------------------------------------------------*/
+
+	static inline uint64_t double_to_bits(double x) {
+		uint64_t b;
+		std::memcpy(&b, &x, sizeof(b));
+		return b;
+	}
+	static inline double bits_to_double(uint64_t b) {
+		double x;
+		std::memcpy(&x, &b, sizeof(x));
+		return x;
+	}
+
+	/*the exponents below this, and at or above this + 256,
+	are boxed
+	*/
+	static const uint64_t float_exponent_base = 896;
+
+	static inline bool fits_unboxed(double x) {
+		if(sizeof(intptr_t) < sizeof(double)) return 0;
+		uint64_t b = double_to_bits(x);
+		uint64_t e = (b >> 52) & 0x7ff;
+		return (e > float_exponent_base &&
+				e < float_exponent_base + 256) ||
+			(b << 1) == 0;
+	}
+
 /*-----------------------------------------------------------------------------
 The tagged pointer type
 -----------------------------------------------------------------------------*/
@@ -199,6 +245,15 @@ Tagged pointer factories
 		intptr_t tmp = x.dat << tag_bits;
 		return ref(tmp + tag_traits<UnicodeChar>::tag);
 	}
+	/*x must be fits_unboxed()*/
+	template<>
+	STATIC_INLINE_SPECIALIZATION ref to_ref<double>(double x) {
+		uint64_t b = double_to_bits(x);
+		uint64_t r = (b << 1) | (b >> 63);
+		/*zeroes are kept as they are*/
+		if(r > 1) r -= float_exponent_base << 53;
+		return ref((intptr_t) (r << tag_bits) + tag_traits<double>::tag);
+	}
 
 	/*no checking, even in debug mode... achtung!*/
 	/*This function is used to convert an int computed using
@@ -286,6 +341,20 @@ Tagged pointer referencing
 		return UnicodeChar(tmp >> tag_bits);
 	}
 
+	template<>
+	STATIC_INLINE_SPECIALIZATION double _as_a<double>(ref obj) {
+		#ifdef DEBUG
+			if(!_is_a<double>(obj)) {
+				throw_TypeError(obj,
+					"incorrect type for unboxed float"
+				);
+			}
+		#endif
+		uint64_t r = ((uint64_t) obj.dat) >> tag_bits;
+		if(r > 1) r += float_exponent_base << 53;
+		return bits_to_double((r >> 1) | (r << 63));
+	}
+
 	/*no checking, even in debug mode... achtung!*/
 	/*This function is used to convert a smallint Object::ref
 	to a useable int that is equal to the "real" int, shifted
@@ -8,6 +8,7 @@
 #include <vector>
 #include <map>
 #include <string>
+#include <stdint.h>
 
 #include <boost/scoped_ptr.hpp>
 #include <boost/noncopyable.hpp>
@@ -23,41 +24,76 @@ public:
 void throw_HlError(char const*);
 
 /*Consider putting this into the process's heap*/
-class ProcessStack : public std::vector<Object::ref> { 
+/*The stack is a contiguous buffer whose live part runs from
+a frame base up to the top.  restack() just moves the base up
+to the outgoing arguments, so a call never shifts the frame;
+the dead space below the base is reclaimed only when the
+buffer fills up.
+Bounds are checked only in DEBUG builds.
+*/
+class ProcessStack : boost::noncopyable {
+private:
+  Object::ref* mem;
+  Object::ref* base;
+  Object::ref* tp; // one past the top
+  Object::ref* lim;
+
+  /*makes room for at least n more pushes*/
+  void make_room(size_t n = 1);
+
+  static void check(bool ok, char const* msg) {
+    #ifdef DEBUG
+      // consider throwing a VMError instead of an hl-side error
+      if(!ok) throw_HlError(msg);
+    #endif
+  }
+
 public:
+  ProcessStack(void) : mem(0), base(0), tp(0), lim(0) { }
+  ~ProcessStack() { delete[] mem; }
+
+  size_t size(void) const { return tp - base; }
+  bool empty(void) const { return tp == base; }
+
   Object::ref & top(size_t off=1){
-    if(off > size() || off == 0){
-      // consider throwing a VMError instead of an hl-side error
-      throw_HlError("internal: process stack underflow in top()");
-    }
-    return (*this)[size() - off];
+    check(off <= size() && off != 0,
+      "internal: process stack underflow in top()");
+    return tp[-(ptrdiff_t) off];
   }
 
   void pop(size_t num=1){
-    if(num > size()){
-      throw_HlError( "internal: Process stack underflow in pop()");
-    }
-    if(num != 0) resize(size() - num);
+    check(num <= size(),
+      "internal: Process stack underflow in pop()");
+    tp -= num;
   }
 
   void push(Object::ref gp){
-    push_back(gp);
+    if(tp == lim) make_room();
+    *tp = gp;
+    ++tp;
   }
 
+  /*makes room for at least n more pushes*/
+  void reserve(size_t n) {
+    if((size_t) (lim - tp) < n) make_room(n);
+  }
+
+  /*keeps only the top sz entries, which become the
+  new frame
+  */
   void restack(size_t sz) {
-    if(sz > size()){
-      throw_HlError( "internal: process stack underflow in restack()");
-    }
-    size_t off = size() - sz;
-    /*Not exactly the best way to do it?*/
-    if(off != 0) erase(begin(), begin() + off);
+    check(sz <= size(),
+      "internal: process stack underflow in restack()");
+    base = tp - sz;
   }
 
   Object::ref& operator[](size_t pos) {
-    if (pos >= size())
-      throw_HlError("internal: stack overflow in []");
-    return (*static_cast<std::vector<Object::ref>*>(this))[pos];
+    check(pos < size(), "internal: stack overflow in []");
+    return base[pos];
   }
+
+  /*native code keeps base and tp in registers*/
+  friend class Jit;
 };
 
 enum ProcessStatus {
@@ -80,6 +116,7 @@ enum ProcessStatus {
 
 class Process;
 class HeapTraverser;
+class BytecodeProfile;
 
 /*
  * A mailbox is an abstraction on top of a Process.
@@ -115,13 +152,16 @@ public:
 	  no messages yet.  Does not change status.*/
 	bool try_extract_message(Object::ref& M, bool& has_message);
 
-	/*traverses the messages in the attached
-	process's mailbox.
+	/*traverses the HlPid objects in the messages
+	in the attached process's mailbox.
 	NOTE!  A message can be received *during*
 	the traversal.  If a message is received,
 	it will *not* be traversed.
 	*/
-	void traverse(HeapTraverser* ht);
+	void traverse_pids(HeapTraverser* ht);
+
+	/*number of messages not yet received*/
+	size_t size(void);
 
 	friend class Process;
 };
@@ -134,6 +174,10 @@ class Process : public Heap {
 private:
 	ProcessStatus stat;
 	bool black;
+	/*set while the process is in some worker's gray set, so
+	that it is pushed onto at most one gray set per collection
+	*/
+	bool gray;
 	AppMutex mtx;
 
 	/*if this flag is true, it means this process is the only
@@ -143,6 +187,15 @@ private:
 
 	/*in the future, consider using a limited cache*/
 	std::map<Symbol*, Object::ref> global_cache;
+	/*the ImplBody values, read through global_cache once,
+	and nil until then or after any global changes
+	*/
+	Object::ref impl_cache[impl_body_count];
+	void clear_impl_cache(void) {
+		for(size_t i = 0; i < impl_body_count; ++i) {
+			impl_cache[i] = Object::nil();
+		}
+	}
 
 	AppMutex notification_mtx;
 	std::vector<Symbol*> invalid_globals;
@@ -177,6 +230,8 @@ private:
 
 	/*The real mailbox*/
 	ValueHolderRef the_mailbox;
+	/*number of messages in it; both protected by mtx*/
+	size_t the_mailbox_size;
 
 public:
 	bool is_only_running(void) const {
@@ -281,14 +336,23 @@ public:
 	Process(void)
 		: stat(process_running),
 		  black(0),
+		  gray(0),
 		  mtx(),
 		  only_running(0),
 		  global_cache(),
+		  impl_cache(),
 		  notification_mtx(),
 		  invalid_globals(),
-		  bytecode_slot(),
 		  multipush(0),
-		  is_main(0)
+		  the_mailbox_size(0),
+		  bytecode_slot(),
+		  is_main(0),
+		  is_registered(0),
+		  accounted_bytes(0),
+		  accounted_status(process_running),
+		  accounted_messages(0),
+		  enqueued_usec(0),
+		  profile(0)
 	{ }
 
 /*-----------------------------------------------------------------------------
@@ -302,6 +366,14 @@ Global Variable Access
 	void global_write(Symbol*, Object::ref);
 	/*clears the cache of global variables*/
 	void global_acquire( void );
+	/*gets the value of an ImplBody global; after the first
+	read, neither looks up the global nor locks anything
+	*/
+	Object::ref impl_read(ImplBody b) {
+		Object::ref& r = impl_cache[b];
+		if(!r) r = global_read(symbol_impl_body[b]);
+		return r;
+	}
 
 /*-----------------------------------------------------------------------------
 For process-level garbage collection
@@ -309,6 +381,16 @@ For process-level garbage collection
 	/*atomically check if status is process_waiting and it is not marked*/
 	bool waiting_and_not_black(void);
 
+	/*atomically check if the process is neither black nor
+	gray, and if so set it to gray.  Returns true if the
+	caller should push the process onto its gray set.
+	*/
+	bool grayen(void);
+	/*as above, but also requires the process to be waiting
+	(or dead)
+	*/
+	bool grayen_if_waiting(void);
+
 	/*anesthesizes this process if appropriate*/
 	/*Must atomically check if process status is process_waiting,
 	and process color is not black.  If so, set to
@@ -334,6 +416,7 @@ For process-level garbage collection
 	void whiten(void) {
 		AppLock l(mtx);
 		black = false;
+		gray = false;
 	}
 	/*checks color.  no atomicity necessary*/
 	bool is_black(void) {
@@ -341,6 +424,12 @@ For process-level garbage collection
 		return black;
 	}
 
+	/*gets the current status*/
+	ProcessStatus status(void) {
+		AppLock l(mtx);
+		return stat;
+	}
+
 	/*checks if the process is dead.*/
 	bool is_dead(void) {
 		AppLock l(mtx);
@@ -390,15 +479,44 @@ For process-level garbage collection
 	/*allows access to the mailbox*/
 	MailBox mailbox(void) { return MailBox(*this); }
 	/*allows access to the history*/
-	History history(void) { return History(stack); }
+	History history(void) { return History(stack, history_ring); }
 
 	ProcessStack stack;
+	/*empty until the first call is recorded*/
+	boost::scoped_ptr<History::Ring> history_ring;
 
 	virtual void scan_root_object(GenericTraverser* gt);
 
 	/*flags if this is the main process*/
 	bool is_main;
 
+	/*flags if this process has been registered into some
+	worker's shard of known processes.  Used only by class
+	AllWorkers and class Worker.
+	*/
+	bool is_registered;
+
+	/*heap bytes last accounted for this process in the
+	process-GC policy.  Used only by class ProcessShard.
+	*/
+	size_t accounted_bytes;
+	/*likewise, the status and number of messages waiting
+	last accounted for this process in the scheduler metrics
+	*/
+	ProcessStatus accounted_status;
+	size_t accounted_messages;
+
+	/*when this process was last pushed on the workqueue.
+	Maintained only while scheduler tracing is enabled.
+	*/
+	uint64_t enqueued_usec;
+
+	/*the bytecode profile of the worker running this process,
+	set by the worker before each slice.  NULL unless
+	profiling.
+	*/
+	BytecodeProfile* profile;
+
 	friend class MailBox;
 };
 
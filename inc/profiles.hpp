@@ -0,0 +1,112 @@
+#ifndef PROFILES_H
+#define PROFILES_H
+
+#include"executors.hpp"
+#include"clock.hpp"
+
+#include<map>
+#include<string>
+#include<ostream>
+#include<cstddef>
+#include<stdint.h>
+
+#include<boost/noncopyable.hpp>
+
+/*-----------------------------------------------------------------------------
+Bytecode profiling
+-----------------------------------------------------------------------------*/
+
+/*the debug name of a function body, with its file and line
+if known
+*/
+std::string describe_body(Bytecode&);
+
+/*Counts of the bytecodes executed by a single worker, and of
+the cycles spent from the dispatch of each one to the dispatch
+of the next, which includes any function call it makes.  The
+same is counted for each function body, identified by the
+debug information of its Bytecode.  Owned by a single worker,
+so nothing is locked; the profiles of all workers are merged
+at exit.
+
+Native code is not profiled, so the JIT is off while
+profiling.
+*/
+class BytecodeProfile : boost::noncopyable {
+public:
+	struct Op {
+		/*name of the bytecode's handler, NULL if never run*/
+		char const* name;
+		uint64_t count;
+		uint64_t cycles;
+	};
+	struct Body {
+		std::string where;
+		uint64_t calls;
+		uint64_t ops;
+		uint64_t cycles;
+	};
+
+private:
+	Op ops[__null_bytecode + 1];
+	/*keyed by the code array, which all copies of a
+	Bytecode share
+	*/
+	typedef std::map<bytecode_t const*, Body> body_map;
+	body_map bodies;
+
+	/*what the cycles since last are charged to*/
+	Op* op;
+	Body* body;
+	bytecode_t const* body_code;
+	uint64_t last;
+
+	void charge(uint64_t now) {
+		if(op) {
+			op->cycles += now - last;
+			if(body) body->cycles += now - last;
+		}
+		last = now;
+	}
+
+public:
+	BytecodeProfile(void);
+
+	/*called at the start of each slice, so that time spent
+	outside of execute() isn't charged to anything
+	*/
+	void start(void) {
+		op = 0;
+		body = 0;
+		body_code = 0;
+	}
+	/*called once the worker leaves execute(), to charge the
+	bytecode that ended the slice, such as a halt or a recv
+	that waits
+	*/
+	void stop(void) {
+		charge(cycle_counter());
+		op = 0;
+		body = 0;
+		body_code = 0;
+	}
+	/*called at the start of each function*/
+	void enter(Bytecode& b) {
+		charge(cycle_counter());
+		if(b.getCode() != body_code) enter_body(b);
+		++body->calls;
+	}
+	void enter_body(Bytecode& b);
+	/*called at the dispatch of each bytecode; not inline,
+	to keep the interpreter small
+	*/
+	void hit(size_t i, char const* name);
+
+	void merge(BytecodeProfile const&);
+	/*writes the bytecodes and the function bodies, most
+	expensive first
+	*/
+	void report(std::ostream&) const;
+};
+
+#endif // PROFILES_H
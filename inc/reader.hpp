@@ -8,8 +8,13 @@
 
 class Process;
 // leaves read bytecode on the stack
+// the stream versions read all the rest of the stream
 void read_bytecode(Process & proc, std::istream & in);
 void read_sequence(Process & proc, std::istream & in);
+// read from the text in [start, end), returning the end of
+// what was read
+char const* read_bytecode(Process & proc, char const* start, char const* end);
+char const* read_sequence(Process & proc, char const* start, char const* end);
 
 // simple printer for debugging
 std::ostream& operator<<(std::ostream & out, Object::ref obj);
@@ -0,0 +1,148 @@
+#ifndef SAMPLES_H
+#define SAMPLES_H
+
+#include"executors.hpp"
+#include"mutexes.hpp"
+
+#include<map>
+#include<vector>
+#include<string>
+#include<utility>
+#include<ostream>
+#include<cstddef>
+
+#include<boost/noncopyable.hpp>
+#include<boost/shared_array.hpp>
+
+class Process;
+
+/*-----------------------------------------------------------------------------
+Stack sampling
+
+A profiling timer (SIGPROF) interrupts the running workers at a
+fixed interval of CPU time.  The signal handler snapshots the
+function body being executed and the bodies of the chain of
+continuations it will return to, as pointers to their code
+arrays, into a ring owned by the interrupted worker; nothing is
+allocated or locked.  Between slices the worker folds its ring
+into a table of counts, and the pointers are only resolved to
+debug names when the samples are written, as folded stacks
+("root;...;leaf count"), which flamegraph tooling reads
+directly.
+-----------------------------------------------------------------------------*/
+
+enum SampleKind {
+	/*the worker was running hl code*/
+	sample_hl,
+	/*the process was in a heap GC, so its stack wasn't
+	walked
+	*/
+	sample_gc,
+	/*the worker wasn't running a process*/
+	sample_scheduler
+};
+
+class SampleBuffer : boost::noncopyable {
+public:
+	/*continuations deeper than this are not recorded*/
+	static size_t const max_depth = 32;
+	struct Sample {
+		unsigned char kind;
+		bool truncated;
+		size_t depth;
+		/*the running body first*/
+		bytecode_t const* frames[max_depth];
+	};
+	/*the frames of a sample, the running body first*/
+	typedef std::pair<int, std::vector<bytecode_t const*> > Stack;
+	typedef std::map<Stack, size_t> stack_map;
+
+private:
+	/*written only by the signal handler at head, and
+	read only by drain() at tail, both on the owning
+	worker's thread
+	*/
+	std::vector<Sample> ring;
+	size_t volatile head;
+	size_t volatile tail;
+
+	stack_map stacks;
+	/*samples lost because the ring was full*/
+	size_t volatile dropped;
+
+	SampleBuffer(void); // disallowed!
+
+public:
+	/*the process the owning worker is executing, NULL
+	between slices
+	*/
+	Process* volatile running;
+
+	explicit SampleBuffer(size_t sz)
+		: ring(sz ? sz : 1), head(0), tail(0), stacks(),
+		  dropped(0), running(0) { }
+
+	/*called from the signal handler*/
+	void take(void);
+
+	bool pending(void) const { return head != tail; }
+	/*folds the ring into the table of counts; called by
+	the owning worker outside of Process::execute
+	*/
+	void drain(void);
+
+	/*makes this the buffer the signal handler writes to
+	when it interrupts the calling thread; NULL detaches
+	*/
+	static void attach(SampleBuffer*);
+
+	friend class Sampler;
+};
+
+class Sampler : boost::noncopyable {
+private:
+	struct Body {
+		/*keeps the code array, and so its address, from
+		being reused by another body
+		*/
+		boost::shared_array<bytecode_t> code;
+		std::string where;
+	};
+	typedef std::map<bytecode_t const*, Body> body_map;
+	body_map bodies;
+	AppMutex mtx;
+
+	std::string name_of(bytecode_t const*) const;
+
+public:
+	/*if non-empty, sample the workers and write the folded
+	stacks to this file at exit.  Set at startup only.
+	*/
+	static std::string file;
+	/*microseconds of CPU time between samples*/
+	static size_t interval_usec;
+	/*number of samples each worker can hold between
+	two slices
+	*/
+	static size_t buffer_size;
+
+	static bool active(void) { return !file.empty(); }
+
+	/*remembers the debug name of a newly assembled body,
+	for when the samples are written; only when active
+	*/
+	void name(Bytecode&);
+
+	/*start and stop the profiling timer*/
+	void start(void);
+	void stop(void);
+
+	/*merges the samples of all the buffers and writes
+	them as folded stacks
+	*/
+	void write(std::ostream&, std::vector<SampleBuffer*> const&);
+};
+
+extern Sampler sampler;
+
+#endif // SAMPLES_H
@@ -57,6 +57,7 @@ public:
 		void* pt = nsp->alloc(real_size());
 		try {
 			new(pt) T(*static_cast<T const*>(this));
+			nsp->track((T*) pt);
 			return (Generic*) pt;
 		} catch(...) {
 			nsp->dealloc(pt);
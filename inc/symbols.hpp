@@ -9,13 +9,24 @@
 #include<string>
 #include<map>
 #include<set>
+#include<cstring>
+#include<stdint.h>
+
+#include<boost/noncopyable.hpp>
+#include<boost/shared_ptr.hpp>
 
 class SymbolsTable;
 
 class Process;
 
 class Symbol {
-	ValueHolderRef value;
+	/*The value is published as an immutable snapshot: set_value
+	replaces the pointer and never changes a ValueHolder already
+	published, so readers can clone the one they loaded without
+	holding any lock, while the value is replaced under them.
+	Only the notification list is protected by m.
+	*/
+	boost::shared_ptr<ValueHolder const> value;
 	std::string printname; //utf-8
 	AppMutex m;
 
@@ -27,22 +38,22 @@ class Symbol {
 public:
 
 	// return true if no value is bound to this symbol
-	bool unbounded() const { return value.empty(); }
+	bool unbounded() const { return !boost::atomic_load(&value); }
 
 	void copy_value_to(ValueHolderRef&);
 	void copy_value_to_and_add_notify(ValueHolderRef&, Process*);
 	void set_value(Object::ref);
 
-	/*removes from the notification list all processes in the
-	given set of dead processes.
+	/*removes all dead processes from the notification list.
 	Not thread safe, intended for use during soft-stop.
 	*/
-	void clean_notification_list(std::set<Process*> const& dead);
+	void clean_notification_list(void);
 
 	std::string getPrintName() { return printname; }
-	/*WARNING! not thread safe. intended for use during soft-stop*/
-	void traverse_objects(HeapTraverser* ht) {
-		value->traverse_objects(ht);
+	/*traverses the HlPid objects in the value.
+	WARNING! not thread safe. intended for use during soft-stop*/
+	void traverse_pids(HeapTraverser* ht) {
+		if(value) value->traverse_pids(ht);
 	}
 	friend class SymbolsTable;
 };
@@ -55,20 +66,39 @@ public:
 
 class SymbolsTable {
 private:
-	/*
-	!! profiling shows that looking up symbols in the table is
-	!! a significant portion of the startup time.  Consider using
-	!! a structure with faster lookup - nested arrays, hash
-	!! tables.  Using a larger structure should be OK since there
-	!! is only one symbol table in the VM.
+	/*Symbols are spread over shards by the hash of their
+	names, so that threads interning different names rarely
+	wait on the same lock.  Each shard is an open-addressed
+	table, probed linearly, which keeps the hash of each name
+	so that most mismatches never touch the name itself.
 	*/
-	std::map<std::string, Symbol*> tb;
-	AppMutex m;
+	struct Entry {
+		uint32_t hash;
+		Symbol* sym;
+	};
+	class Shard : boost::noncopyable {
+	public:
+		AppMutex m;
+		std::vector<Entry> slots; // size is a power of 2
+		size_t count;
+		Shard(void) : m(), slots(16), count(0) { }
+		void grow(void);
+	};
+	static size_t const shard_bits = 6;
+	Shard shards[1 << shard_bits];
+
+	static uint32_t hash(char const*, size_t);
 
 public:
-	Symbol* lookup(std::string);
+	/*looks up the name s[0..len), which need not be
+	null-terminated, making a new symbol if there is none
+	*/
+	Symbol* lookup(char const* s, size_t len);
+	inline Symbol* lookup(std::string const& s) {
+		return lookup(s.data(), s.size());
+	}
 	inline Symbol* lookup(char const* s) {
-		return lookup(std::string(s));
+		return lookup(s, std::strlen(s));
 	}
 	/*note! no atomicity checks.  assumes that traversal
 	occurs only when all other worker threads are suspended.
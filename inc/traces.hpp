@@ -0,0 +1,120 @@
+#ifndef TRACES_H
+#define TRACES_H
+
+#include<vector>
+#include<ostream>
+#include<cstddef>
+#include<stdint.h>
+
+#include<boost/noncopyable.hpp>
+
+class Process;
+
+/*-----------------------------------------------------------------------------
+Scheduler tracing
+-----------------------------------------------------------------------------*/
+
+enum TraceEventKind {
+	/*a single Process::execute slice*/
+	trace_slice,
+	/*a process_change: P donated its remaining timeslice to Q*/
+	trace_donate,
+	/*the worker waited for a soft-stop to be lowered*/
+	trace_soft_stop,
+	/*the worker raised a soft-stop to start marking*/
+	trace_gc_start,
+	/*the worker raised a soft-stop to sweep*/
+	trace_gc_sweep
+};
+
+/*where the process run in a slice came from*/
+enum TraceSource {
+	/*popped from the workqueue*/
+	source_workqueue,
+	/*kept running, since the workqueue was empty*/
+	source_kept,
+	/*switched to via process_change*/
+	source_donated
+};
+
+class TraceEvent {
+public:
+	uint64_t start;
+	uint64_t end;
+	Process* P;
+	Process* Q;
+	/*for slices: reductions used
+	for donations: remaining timeslice
+	*/
+	size_t value;
+	/*for slices: the time the process spent in the
+	workqueue, if it came from there
+	*/
+	uint64_t delay;
+	unsigned char kind;
+	unsigned char status;
+	unsigned char source;
+};
+
+/*A preallocated ring of trace events, owned by a single
+worker.  Once full, the oldest events are overwritten.
+*/
+class TraceBuffer : boost::noncopyable {
+private:
+	std::vector<TraceEvent> events;
+	size_t next;
+	bool wrapped;
+
+	TraceBuffer(void); // disallowed!
+
+public:
+	size_t const id;
+
+	TraceBuffer(size_t nid, size_t sz)
+		: events(sz ? sz : 1), next(0), wrapped(0), id(nid) { }
+
+	TraceEvent& push(void) {
+		TraceEvent& e = events[next];
+		++next;
+		if(next == events.size()) {
+			next = 0;
+			wrapped = 1;
+		}
+		return e;
+	}
+
+	void slice(uint64_t start, uint64_t end, Process* P,
+			size_t reductions, int status, int source,
+			uint64_t delay) {
+		TraceEvent& e = push();
+		e.kind = trace_slice;
+		e.start = start; e.end = end;
+		e.P = P; e.Q = 0;
+		e.value = reductions;
+		e.status = status;
+		e.source = source;
+		e.delay = delay;
+	}
+	void donate(uint64_t at, Process* P, Process* Q, size_t timeslice) {
+		TraceEvent& e = push();
+		e.kind = trace_donate;
+		e.start = e.end = at;
+		e.P = P; e.Q = Q;
+		e.value = timeslice;
+	}
+	void span(TraceEventKind kind, uint64_t start, uint64_t end) {
+		TraceEvent& e = push();
+		e.kind = kind;
+		e.start = start; e.end = end;
+		e.P = e.Q = 0;
+	}
+
+	/*writes the events as Chrome trace events, each
+	preceded by a comma.  Timestamps are made relative
+	to base.
+	*/
+	void write_json(std::ostream&, uint64_t base) const;
+};
+
+#endif // TRACES_H
+
@@ -6,15 +6,16 @@ Defines a set of types for use on the hl-side.
 
 #include<cstring>
 #include<string>
+#include<typeinfo>
 #include<boost/shared_ptr.hpp>
 #include<boost/shared_array.hpp>
-#include<boost/scoped_ptr.hpp>
 
 #include"objects.hpp"
 #include"specializeds.hpp"
 #include"heaps.hpp"
 #include"processes.hpp"
 #include"history.hpp"
+#include"bigints.hpp"
 
 /*-----------------------------------------------------------------------------
 Utility
@@ -63,6 +64,18 @@ static inline T* maybe_type(Object::ref x) {
 	return dynamic_cast<T*>(as_a<Generic*>(x));
 }
 
+/*Like maybe_type, but for a class T that nothing derives
+from: comparing the dynamic type is cheaper than a
+dynamic_cast, which matters on the function call path.
+*/
+template<class T>
+static inline T* maybe_exact_type(Object::ref x) {
+	if(!is_a<Generic*>(x)) return NULL;
+	Generic* gp = as_a<Generic*>(x);
+	if(typeid(*gp) != typeid(T)) return NULL;
+	return static_cast<T*>(gp);
+}
+
 /*-----------------------------------------------------------------------------
 Cons cell
 -----------------------------------------------------------------------------*/
@@ -164,23 +177,20 @@ class Closure : public GenericDerivedVariadic<Closure> {
 private:
   Object::ref body;
   bool nonreusable;
-  boost::scoped_ptr<History::InnerRing> kontinuation;
+  /*true if this is a continuation closure*/
+  bool continuation;
 
 public:
   Closure(size_t sz) : GenericDerivedVariadic<Closure>(sz), 
                        nonreusable(true),
-                       kontinuation() {}
+                       continuation(false) {}
 
   /*copy constructor*/
   Closure(Closure const& o)
-    : body(o.body),
+    : GenericDerivedVariadic<Closure>(o),
+      body(o.body),
       nonreusable(true),
-      GenericDerivedVariadic<Closure>(o),
-      kontinuation(
-        o.kontinuation ?
-         new History::InnerRing(*o.kontinuation) :
-        /*else*/
-         0) { }
+      continuation(o.continuation) { }
   Object::ref& operator[](size_t i) { 
     if (i < size())
       return index(i);
@@ -199,7 +209,7 @@ public:
       Object::ref tmp = kp->index(i);
       if(is_a<Generic*>(tmp)) {
         Closure* cp = dynamic_cast<Closure*>(as_a<Generic*>(tmp));
-        if(cp && cp->kontinuation) {
+        if(cp && cp->continuation) {
           /*assume only one continuation is actually referred to
           directly (this is what the compiler emits anyway)
           */
@@ -210,6 +220,7 @@ public:
     }
   }
   bool reusable() { return !nonreusable; }
+  bool is_continuation() const { return continuation; }
 
   static Closure* NewKClosure(Heap & h, size_t n);
   static Closure* NewClosure(Heap & h, size_t n);
@@ -223,10 +234,10 @@ public:
     for(size_t i = 0; i < sz; ++i) {
       gt->traverse(index(i));
     }
-    if(kontinuation) kontinuation->traverse_references(gt);
   }
 
   friend class History;
+  friend class SampleBuffer;
 };
 
 /*-----------------------------------------------------------------------------
@@ -648,15 +659,21 @@ public:
 Floating point numbers
 -----------------------------------------------------------------------------*/
 
+/*Most floats are unboxed (see objects.hpp), and only the others
+are kept in a Float.  A float that can be unboxed is never a
+Float, so equal unboxed floats are is-equal.
+*/
 class Float : public GenericDerived<Float> {
 private:
   double val;
 public:
-  // construction
-  static inline Float* mk(Heap & h, double val) {
+  // the float val, unboxed if it can be
+  static inline Object::ref mk(Heap & h, double val) {
+    if (Object::fits_unboxed(val))
+      return Object::to_ref(val);
     Float *f = h.create<Float>();
     f->val = val;
-    return f;
+    return Object::to_ref<Generic*>(f);
   }
   // make a float that will live forever
   static inline Float* mkEternal(double val) {
@@ -671,24 +688,96 @@ public:
   // Numbers are immutable
 };
 
+/*true if x is a float, boxed or not*/
+static inline bool is_float(Object::ref x) {
+  return is_a<double>(x) || maybe_type<Float>(x);
+}
+
+/*the value of a float, boxed or not*/
+static inline double float_value(Object::ref x) {
+  if (is_a<double>(x)) {
+    return as_a<double>(x);
+  } else {
+    return known_type<Float>(x)->get();
+  }
+}
+
+/*-----------------------------------------------------------------------------
+Big integers
+-----------------------------------------------------------------------------*/
+
+/*An integer outside of the smallint range.  The limbs are kept
+in the variadic space, which the GC copies but, having no
+references, doesn't traverse.  An integer that fits in a
+smallint is never a BigInt, so smallints and BigInts are never
+is-equal.
+*/
+class BigInt : public GenericDerivedVariadic<BigInt> {
+private:
+  bool neg;
+  size_t len;
+  limb_t* limbs(void) const {
+    char* cp = (char*) const_cast<BigInt*>(this);
+    return (limb_t*) (cp + sizeof(BigInt));
+  }
+public:
+  explicit BigInt(size_t sz)
+    : GenericDerivedVariadic<BigInt>(sz), neg(0), len(0) { }
+  // the integer v, as a smallint if it fits
+  static Object::ref mk(Heap & h, BigValue const& v);
+  void value(BigValue& v) const {
+    v.neg = neg;
+    v.mag.assign(limbs(), limbs() + len);
+  }
+  double to_double(void) const;
+  bool is(Object::ref) const;
+  void enhash(HashingClass*) const;
+  Object::ref type(void) const {
+    return Object::to_ref(symbol_int);
+  }
+  // Numbers are immutable
+};
+
+/*on platforms where int is as wide as a pointer, a smallint
+loses the tag bits; elsewhere this is always true
+*/
+static inline bool is_smallint(int x) {
+  return x >= Object::smallint_min && x <= Object::smallint_max;
+}
+
+/*true if x is an integer, small or not*/
+static inline bool is_integer(Object::ref x) {
+  return is_a<int>(x) || maybe_type<BigInt>(x);
+}
+
+/*the value of an integer, small or not*/
+static inline void integer_value(Object::ref x, BigValue& v) {
+  if (is_a<int>(x)) {
+    v = BigValue(as_a<int>(x));
+  } else {
+    known_type<BigInt>(x)->value(v);
+  }
+}
+
 /*conversion*/
 inline Object::ref i_to_f( Object::ref o, Process& proc ) {
-	#ifdef DEBUG
-		if(!is_a<int>(o)) {
-			throw_HlError("'i-to-f expected int");
-		}
-	#endif
-	return Object::to_ref<Generic*>(
-		Float::mk(proc.heap(), (double) as_a<int>(o))
-	);
+	double d;
+	if(is_a<int>(o)) {
+		d = (double) as_a<int>(o);
+	} else {
+		d = expect_type<BigInt>(o, "'i-to-f expected int")->to_double();
+	}
+	return Float::mk(proc.heap(), d);
 }
 
 inline Object::ref f_to_i( Object::ref o ) {
 	#ifdef DEBUG
-		Float* tmp = expect_type<Float>(o, "f-to-i expected float");
+		if(!is_float(o)) {
+			throw_HlError("f-to-i expected float");
+		}
 	#endif
 	return Object::to_ref<int>(
-		(int) known_type<Float>(o)->get()
+		(int) float_value(o)
 	);
 }
 
@@ -967,6 +1056,9 @@ extern inline Object::ref type(Object::ref ob) {
 	if(is_a<UnicodeChar>(ob)) {
 		return Object::to_ref(symbol_char);
 	}
+	if(is_a<double>(ob)) {
+		return Object::to_ref(symbol_float);
+	}
 }
 
 extern inline Object::ref rep(Object::ref ob) {
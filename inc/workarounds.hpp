@@ -67,5 +67,30 @@ Known to occur on GCC >= 2.96
 	#define F_INLINE
 #endif
 
+/*-----------------------------------------------------------------------------
+Non-issue: GCC provides overflow-checked integer arithmetic, which
+	compiles to the operation followed by a jump on the overflow flag
+Known to be supported on GCC >= 5
+-----------------------------------------------------------------------------*/
+
+#ifdef __GNUC__
+	#if __GNUC_VERSION__ >= 50000
+		#define add_overflow(a, b, r)	__builtin_add_overflow(a, b, r)
+		#define sub_overflow(a, b, r)	__builtin_sub_overflow(a, b, r)
+		#define mul_overflow(a, b, r)	__builtin_mul_overflow(a, b, r)
+	#endif
+#endif
+
+#ifndef add_overflow
+	/*for int only: the result fits in a long long*/
+	static inline bool _int_overflow(long long x, int* r) {
+		*r = (int) x;
+		return x != (long long) *r;
+	}
+	#define add_overflow(a, b, r)	_int_overflow((long long) (a) + (b), r)
+	#define sub_overflow(a, b, r)	_int_overflow((long long) (a) - (b), r)
+	#define mul_overflow(a, b, r)	_int_overflow((long long) (a) * (b), r)
+#endif
+
 #endif // WORKAROUNDS_H
 
@@ -3,22 +3,158 @@
 
 #include"lockeds.hpp"
 #include"mutexes.hpp"
+#include"processes.hpp"
+#include"traces.hpp"
 
 #include<vector>
-#include<set>
 #include<queue>
+#include<string>
+#include<fstream>
+#include<cstddef>
+#include<stdint.h>
 
 #include<boost/thread/barrier.hpp>
 #include<boost/thread/mutex.hpp>
 #include<boost/thread/thread.hpp>
 #include<boost/noncopyable.hpp>
+#include<boost/scoped_ptr.hpp>
 
 class Worker;
 class Process;
 
+class BytecodeProfile;
+class SampleBuffer;
+
 class SymbolProcessScanner;
 class EventSetScanner;
 
+/*A partition of the set of known processes.  Each worker
+owns one shard and registers the processes it spawns into
+it without taking any lock.  Shards of other workers are
+touched only during soft-stop, i.e. by the sweep, though
+their counters may be read at any time.
+*/
+class ProcessShard : boost::noncopyable {
+public:
+	std::vector<Process*> U;
+
+	/*number of processes registered since the last
+	process-level GC
+	*/
+	RelaxedCounter<size_t> registered;
+
+	/*heap bytes accounted through this shard.  Processes
+	move between workers, so a single shard may go negative;
+	only the sum over all shards is meaningful.
+	*/
+	RelaxedCounter<ptrdiff_t> heap_bytes;
+
+	/*processes in each status, and messages waiting in
+	their mailboxes, as of the end of each process's last
+	slice.  Like heap_bytes, only the sums are meaningful.
+	*/
+	RelaxedCounter<ptrdiff_t> processes[process_running + 1];
+	RelaxedCounter<ptrdiff_t> messages;
+
+	/*registers a process; only the owning worker, or a
+	worker during soft-stop, may call this
+	*/
+	void register_process(Process*);
+
+	/*updates heap_bytes, processes and messages with the
+	current state of a process that this worker has just run
+	*/
+	void account(Process*);
+
+	/*partitions U into live and dead processes, whitening
+	the live ones and killing the dead ones.  Returns the
+	index of the first dead process, and resets the counters
+	to describe only the live processes.
+	Intended for use during soft-stop.
+	*/
+	size_t partition(void);
+
+	/*deletes all processes from index j onwards*/
+	void delete_from(size_t j);
+
+	ProcessShard(void)
+		: U(), registered(0), heap_bytes(0), processes(), messages(0) { }
+	~ProcessShard();
+};
+
+/*Decides when to start a process-level GC.  A collection is
+started when either the number of processes registered since
+the last one, or the growth in the total heap bytes of all
+processes since the last one, reaches a threshold.  Each
+threshold is a percentage of what survived the last
+collection, but never less than a fixed minimum.
+*/
+class ProcessGCPolicy {
+public:
+	size_t min_processes;
+	size_t process_growth; // percent of surviving processes
+	size_t min_heap_bytes;
+	size_t heap_growth; // percent of surviving heap bytes
+
+	/*the trigger worker sums the shards' counters only once
+	every this many slices, unless it is idle
+	*/
+	static size_t const check_interval = 64;
+
+	/*if true, print a line to stderr after each collection*/
+	bool report;
+
+	/*what survived the last collection*/
+	size_t live_processes;
+	size_t live_heap_bytes;
+
+	size_t process_threshold(void) const {
+		size_t t = live_processes * process_growth / 100;
+		return (t < min_processes) ? min_processes : t;
+	}
+	size_t heap_threshold(void) const {
+		size_t t = live_heap_bytes * heap_growth / 100;
+		return (t < min_heap_bytes) ? min_heap_bytes : t;
+	}
+
+	ProcessGCPolicy(void)
+		: min_processes(4096),
+		  process_growth(100),
+		  min_heap_bytes(16 * 1024 * 1024),
+		  heap_growth(100),
+		  report(0),
+		  live_processes(0),
+		  live_heap_bytes(0) { }
+};
+
+/*A sample of the load on the scheduler*/
+class SchedulerMetrics {
+public:
+	/*microseconds since initiate() was called*/
+	uint64_t usec;
+	size_t workqueue;
+	size_t waitqueue;
+	/*number of processes in each status*/
+	size_t running;
+	size_t waiting;
+	size_t anesthesized;
+	size_t dead;
+	/*messages sent but not yet received, over all processes*/
+	size_t mailbox;
+	/*bytes used by the heaps of all processes*/
+	size_t heap_bytes;
+	/*bytes of bodies in the code space, shared by them all*/
+	size_t code_bytes;
+	/*bodies that didn't fit in the code space*/
+	size_t code_unshared;
+
+	SchedulerMetrics(void)
+		: usec(0), workqueue(0), waitqueue(0),
+		  running(0), waiting(0), anesthesized(0), dead(0),
+		  mailbox(0), heap_bytes(0), code_bytes(0),
+		  code_unshared(0) { }
+};
+
 class AllWorkers : boost::noncopyable {
 	bool exit_condition;
 
@@ -38,9 +174,11 @@ class AllWorkers : boost::noncopyable {
 	size_t total_workers;
 	std::vector<Worker*> Ws;
 
-	/*set of known processes*/
-	std::vector<Process*> U;
-	AppMutex U_mtx;
+	/*set of known processes, partitioned into shards.  A
+	shard is added whenever a worker registers and outlives
+	its worker; the vector itself is protected by general_mtx.
+	*/
+	std::vector<ProcessShard*> shards;
 
 	std::queue<Process*> workqueue;
 	/*
@@ -53,6 +191,64 @@ class AllWorkers : boost::noncopyable {
 	/*default timeslice for processes*/
 	size_t default_timeslice;
 
+	/*when the current process-level GC was triggered*/
+	uint64_t gc_start_usec;
+
+	/*slices since the trigger worker last summed the shards*/
+	size_t gc_check_count;
+
+	/*when initiate() was called*/
+	uint64_t start_usec;
+
+	/*scheduler trace buffers, one per worker that has ever
+	registered.  Empty unless tracing.  Protected by
+	general_mtx.
+	*/
+	bool tracing;
+	std::vector<TraceBuffer*> traces;
+
+	/*writes all trace buffers to trace_file*/
+	void write_trace(void);
+
+	/*bytecode profiles, one per worker that has ever
+	registered.  Empty unless profiling.  Protected by
+	general_mtx.
+	*/
+	std::vector<BytecodeProfile*> profiles;
+
+	/*merges the bytecode profiles and reports them on
+	stderr
+	*/
+	void write_profile(void);
+
+	/*stack sample buffers, one per worker that has ever
+	registered.  Empty unless sampling.  Protected by
+	general_mtx.
+	*/
+	std::vector<SampleBuffer*> samples;
+
+	/*writes the folded stacks of all sample buffers to
+	Sampler::file
+	*/
+	void write_samples(void);
+
+	uint64_t metrics_next_usec;
+	boost::scoped_ptr<std::ofstream> metrics_out;
+
+	/*determines if it's time for the trigger worker to write
+	another metrics sample
+	*/
+	bool metrics_due(void);
+
+	/*takes a metrics sample and appends it to metrics_file*/
+	void write_metrics(void);
+
+	/*determines if a process-level GC should be started.
+	If idle, the trigger worker has nothing else to do, so
+	a GC is started if anything at all could be collected.
+	*/
+	bool process_gc_due(bool idle);
+
 	/*check for soft-stop state and do so if needed*/
 	void soft_stop_check(Worker*, Process*&);
 
@@ -92,6 +288,29 @@ class AllWorkers : boost::noncopyable {
 
 	LockedValueHolderRef return_value;
 public:
+	/*set before calling initiate()*/
+	ProcessGCPolicy gc_policy;
+	/*if non-empty, record scheduler events and write them
+	to this file as a Chrome trace after initiate() finishes
+	*/
+	std::string trace_file;
+	/*number of events kept per worker*/
+	size_t trace_size;
+
+	/*if true, count the bytecodes executed, and report them
+	on stderr after initiate() finishes
+	*/
+	bool profile_bytecodes;
+
+	/*if non-empty, a metrics sample is appended to this file
+	as a line when initiate() starts and ends, and, if
+	metrics_interval_ms is non-zero, at that interval
+	*/
+	size_t metrics_interval_ms;
+	std::string metrics_file;
+
+	/*takes a metrics sample from the shards' counters*/
+	SchedulerMetrics get_metrics(void);
 
 	static AllWorkers& getInstance() {
 		return workers;
@@ -106,7 +325,11 @@ public:
 	*/
 	void initiate(size_t, Process*, ValueHolderRef&);
 
-	/*atomically register a process into U*/
+	/*register a process into the first shard.  Used only to
+	register the starting process, before any worker runs;
+	workers register the processes they spawn into their own
+	shards.
+	*/
 	void register_process(Process*);
 
 	/*request and release soft-stop*/
@@ -121,13 +344,28 @@ public:
 
 /*Must be copyable!*/
 class Worker {
-	std::set<Process*> gray_set;
+	/*processes are pushed here only after being set to gray,
+	so each process appears at most once across all gray sets
+	*/
+	std::vector<Process*> gray_set;
 	bool gray_done;
 	bool scanning_mode;
 	bool in_gc;
 
 	AllWorkers* parent;
 
+	/*this worker's part of the set of known processes*/
+	ProcessShard* shard;
+
+	/*this worker's scheduler trace, if tracing*/
+	TraceBuffer* trace;
+
+	/*this worker's bytecode profile, if profiling*/
+	BytecodeProfile* profile;
+
+	/*this worker's stack samples, if sampling*/
+	SampleBuffer* samples;
+
 	/*worker waits on this when it can't get a process to work on yet*/
 	AppSemaphore waiting_sema;
 
@@ -138,30 +376,40 @@ class Worker {
 	void mark_process(Process*);
 
 public:
-	/*process-level GC triggering*/
+	/*process-level GC triggering: non-zero if this worker is
+	the one that will start the next collection
+	*/
 	size_t T;
 
 	/*callable, used to launch a thread*/
 	void operator()(bool is_main=0);
 
 	explicit Worker(AllWorkers* nparent)
-		: parent(nparent),
-		gray_set(),
+		: gray_set(),
 		gray_done(1),
 		scanning_mode(0),
 		in_gc(0),
-		T(0),
-		waiting_sema()
+		parent(nparent),
+		shard(0),
+		trace(0),
+		profile(0),
+		samples(0),
+		waiting_sema(),
+		T(0)
 	{ }
 
 	explicit Worker(Worker const& o)
-		: parent(o.parent),
-		gray_set(o.gray_set),
+		: gray_set(o.gray_set),
 		gray_done(o.gray_done),
 		scanning_mode(o.scanning_mode),
 		in_gc(o.in_gc),
-		T(o.T),
-		waiting_sema()
+		parent(o.parent),
+		shard(0),
+		trace(0),
+		profile(0),
+		samples(0),
+		waiting_sema(),
+		T(o.T)
 	{ }
 
 	friend class SymbolProcessScanner;
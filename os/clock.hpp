@@ -0,0 +1,33 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include<time.h>
+#include<stdint.h>
+
+/*monotonic time in microseconds; meaningful only as the
+difference of two readings
+*/
+inline uint64_t monotonic_usec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*a fast, fine-grained, monotonic-ish counter for profiling:
+the time stamp counter where there is one, otherwise
+nanoseconds
+*/
+inline uint64_t cycle_counter(void) {
+	#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		uint32_t lo, hi;
+		__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+		return ((uint64_t) hi << 32) | lo;
+	#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ((uint64_t) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+	#endif
+}
+
+#endif // CLOCK_H
+
@@ -2,6 +2,7 @@
 #define READ_DIRECTORY_H
 
 #include<sys/types.h>
+#include<sys/stat.h>
 #include<dirent.h>
 #include<errno.h>
 
@@ -57,5 +58,12 @@ std::vector<std::string> read_directory(std::string const& path) {
 	return rv;
 }
 
+/*last modification time of a file, or 0 if it can't be read*/
+time_t file_mtime(std::string const& path) {
+	struct stat st;
+	if(stat(path.c_str(), &st) != 0) return 0;
+	return st.st_mtime;
+}
+
 #endif // READ_DIRECTORY_H
 
@@ -0,0 +1,140 @@
+#include"all_defines.hpp"
+
+#include"asmcache.hpp"
+#include"assembler.hpp"
+#include"processes.hpp"
+#include"types.hpp"
+
+AssemblyCache asm_cache;
+
+size_t AssemblyCache::capacity = 256;
+
+/*FNV-1a*/
+static uint64_t hash_key(std::string const& key) {
+	uint64_t h = 14695981039346656037ULL;
+	for(size_t i = 0; i < key.size(); ++i) {
+		h ^= (unsigned char) key[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static void put(std::string& key, char tag, uint64_t x) {
+	key += tag;
+	for(size_t i = 0; i < 8; ++i) {
+		key += (char) (x & 0xFF);
+		x >>= 8;
+	}
+}
+
+static bool encode(std::string& key, Object::ref o) {
+	/*walk down the cdrs without recursing*/
+	for(;;) {
+		Cons* c;
+		if(o == Object::nil()) {
+			key += 'n';
+		} else if(o == Object::t()) {
+			key += 't';
+		} else if(is_a<int>(o)) {
+			put(key, 'i', (uint64_t) (intptr_t) as_a<int>(o));
+		} else if(is_float(o)) {
+			put(key, 'f', Object::double_to_bits(float_value(o)));
+		} else if(is_a<Symbol*>(o)) {
+			/*symbols are never freed, so the address names one*/
+			put(key, 's', (uint64_t) (uintptr_t) as_a<Symbol*>(o));
+		} else if(is_a<UnicodeChar>(o)) {
+			put(key, 'C', as_a<UnicodeChar>(o).dat);
+		} else if((c = maybe_type<Cons>(o))) {
+			key += 'c';
+			if(!encode(key, c->car())) return false;
+			o = c->cdr();
+			continue;
+		} else {
+			return false;
+		}
+		return true;
+	}
+}
+
+bool AssemblyCache::key_of(Object::ref seq, std::string& key) {
+	key.clear();
+	/*the same sequence assembles differently at another level*/
+	put(key, 'O', assembler.opt_level);
+	return encode(key, seq);
+}
+
+AssemblyCache::hash_map::iterator AssemblyCache::find(
+		uint64_t hash, std::string const& key) {
+	std::pair<hash_map::iterator, hash_map::iterator> r =
+		index.equal_range(hash);
+	for(hash_map::iterator it = r.first; it != r.second; ++it) {
+		if(it->second->key == key) return it;
+	}
+	return index.end();
+}
+
+void AssemblyCache::evict(void) {
+	lru_list::iterator last = --lru.end();
+	std::pair<hash_map::iterator, hash_map::iterator> r =
+		index.equal_range(last->hash);
+	for(hash_map::iterator it = r.first; it != r.second; ++it) {
+		if(it->second == last) {
+			index.erase(it);
+			break;
+		}
+	}
+	lru.erase(last);
+	++evictions;
+}
+
+bool AssemblyCache::lookup(Process& proc, std::string const& key) {
+	uint64_t h = hash_key(key);
+	boost::shared_ptr<ValueHolder const> code;
+	{AppLock l(m);
+		hash_map::iterator it = find(h, key);
+		if(it == index.end()) {
+			++misses;
+			return false;
+		}
+		++hits;
+		lru.splice(lru.begin(), lru, it->second);
+		code = it->second->code;
+	}
+	/*the snapshot is never changed, and our reference keeps
+	it alive even if it is evicted meanwhile
+	*/
+	ValueHolderRef copy;
+	code->clone(copy);
+	proc.stack.top() = copy.value();
+	proc.other_spaces.insert(copy);
+	/*as after a recv: don't let the copies pile up until the
+	next GC
+	*/
+	proc.maybe_clear_other_spaces();
+	return true;
+}
+
+void AssemblyCache::insert(Process& proc, std::string const& key) {
+	ValueHolderRef tmp;
+	ValueHolder::copy_object(tmp, proc.stack.top());
+	Entry e;
+	e.hash = hash_key(key);
+	e.key = key;
+	e.code.reset(tmp.release());
+	AppLock l(m);
+	/*another worker may have assembled it meanwhile*/
+	if(find(e.hash, key) != index.end()) return;
+	lru.push_front(e);
+	index.insert(std::make_pair(e.hash, lru.begin()));
+	while(index.size() > capacity) evict();
+}
+
+AssemblyCache::Metrics AssemblyCache::get_metrics(void) {
+	AppLock l(m);
+	Metrics rv;
+	rv.hits = hits;
+	rv.misses = misses;
+	rv.evictions = evictions;
+	rv.entries = index.size();
+	return rv;
+}
@@ -1,6 +1,8 @@
 #include "all_defines.hpp"
 #include "types.hpp"
 #include "assembler.hpp"
+#include "samples.hpp"
+#include "asmcache.hpp"
 
 #include <sstream>
 
@@ -29,7 +31,7 @@ size_t GenClosureAs::disassemble(Process & proc, size_t i) {
     // handle (float ...) bytecode here
     // !! it should be in ComplexAs::disassemble
     // !! but const-ref is already catched by GenClosureAs
-    if (!maybe_type<Float>(body)) {
+    if (!is_float(body)) {
       throw_HlError("can't disassemble: reference to invalid object found");
     }
     proc.stack.push(body);
@@ -52,7 +54,7 @@ size_t GenClosureAs::disassemble(Process & proc, size_t i) {
   //  - current Bytecode
   b = expect_type<Bytecode>(proc.stack.top(2));
   bytecode_t next = b->getCode()[i+1];
-  Symbol *opname = operationName(inv_bytetb[next.op]);
+  Symbol *opname = operationName(assembler.name(next.op));
   size_t N = next.val;
   Cons *c = proc.create<Cons>();
   c->scar(Object::to_ref(opname));
@@ -127,6 +129,8 @@ size_t IfAs::disassemble(Process & proc, size_t i) {
 Assembler assembler;
 
 void Assembler::go(Process & proc) {
+  if (opt_level >= 1)
+    optimize(proc);
   Bytecode *b = proc.create_variadic<Bytecode>(countConsts(proc.stack.top()));
   proc.stack.push(Object::to_ref(b));
 
@@ -175,20 +179,25 @@ void Assembler::go(Process & proc) {
     if (!is_a<Symbol*>(car(current_op)))
       throw_HlError("assemble: symbol expected in operator position");
     Symbol *op = as_a<Symbol*>(car(current_op));
-    sym_op_tbl::iterator it = tbl.find(op);
-    if (it!=tbl.end()) {
+    Opcode const* o = find(op);
+    if (o && o->as) {
       // do the call
-      it->second->assemble(proc);
+      o->as->assemble(proc);
     } else {
       // default behavior:
       // ignore sequence, extracts the simple argument and lookup
       // an interpretable bytecode
+      if (!o || o->label == NULL_BYTECODE) {
+        std::string err = "assemble: unknown bytecode form: ";
+        err += op->getPrintName();
+        throw_HlError(err.c_str());
+      }
       proc.stack.pop(); // throw away sequence
       Object::ref arg = proc.stack.top(); proc.stack.pop();
       if (isComplexConst(arg))
         throw_HlError("assemble: complex arg found where simple expected");
       Bytecode *b = expect_type<Bytecode>(proc.stack.top());
-      b->push(op, simpleVal(arg));
+      b->push(o->label, simpleVal(*o, arg));
     }
   }
   // remove empty sequence
@@ -196,6 +205,243 @@ void Assembler::go(Process & proc) {
   proc.stack.pop();
   // stack now is
   //  - bytecode
+  finish(expect_type<Bytecode>(proc.stack.top()));
+}
+
+void Assembler::finish(Bytecode *b) {
+  if (opt_level >= 2)
+    fuse(b);
+  b->finalize();
+  // the stack sampler resolves code to names only at exit
+  if (Sampler::active())
+    sampler.name(*b);
+}
+
+// the forms the optimizer looks for, looked up once
+struct PeepholeForms {
+  Symbol *if_, *lit_nil, *lit_t, *int_, *float_;
+  PeepholeForms()
+    : if_(symbols->lookup("<bc>if")),
+      lit_nil(symbols->lookup("<bc>lit-nil")),
+      lit_t(symbols->lookup("<bc>lit-t")),
+      int_(symbols->lookup("<bc>int")),
+      float_(symbols->lookup("<bc>float")) { }
+};
+
+static PeepholeForms const& forms() {
+  static PeepholeForms f;
+  return f;
+}
+
+static bool is_op(Object::ref form, Symbol *s) {
+  return maybe_type<Cons>(form) && car(form) == Object::to_ref(s);
+}
+
+bool Assembler::constValue(Object::ref form, Object::ref & v) {
+  PeepholeForms const& fs = forms();
+  if (is_op(form, fs.lit_nil)) {
+    v = Object::nil();
+    return true;
+  }
+  if (is_op(form, fs.lit_t)) {
+    v = Object::t();
+    return true;
+  }
+  if (!maybe_type<Cons>(form) || !maybe_type<Cons>(cdr(form)))
+    return false;
+  Object::ref arg = car(cdr(form));
+  if ((is_op(form, fs.int_) && is_a<int>(arg)) ||
+      (is_op(form, fs.float_) && is_float(arg))) {
+    v = arg;
+    return true;
+  }
+  return false;
+}
+
+// after a rewrite, step back over the constants just before it: at
+// most two, as no rewrite looks at more than two cells before the
+// one it applies to
+static void step_back(ProcessStack & stack, size_t head) {
+  Object::ref v;
+  for (size_t n = 0; n < 2 && stack.size() > head + 1 &&
+         Assembler::constValue(car(stack.top()), v); ++n)
+    stack.pop();
+}
+
+/*
+ * A single pass over the seq, which is kept on the stack with each
+ * cell already passed above it: the cell being looked at is the cdr
+ * of the last one, and a rewrite only needs to step back a few cells
+ * to see what it made possible.  Cells are found again through the
+ * stack after anything that allocates.  Like IfAs, this reuses the
+ * cells of the seq being assembled.
+ */
+void Assembler::optimize(Process & proc) {
+  PeepholeForms const& fs = forms();
+  ProcessStack & stack = proc.stack;
+  size_t const head = stack.size() - 1;
+  for (;;) {
+    bool first = stack.size() == head + 1;
+    Object::ref cell = first ? stack[head] : cdr(stack.top());
+    if (cell == Object::nil())
+      break;
+    Object::ref f0 = car(cell);
+    Object::ref c1 = cdr(cell);
+    Object::ref f1 = c1 != Object::nil() ? car(c1) : Object::nil();
+    Object::ref c2 = c1 != Object::nil() ? cdr(c1) : Object::nil();
+    Object::ref v0, v1;
+
+    // a constant followed by an 'if: the branch is either always
+    // or never taken
+    if (is_op(f1, fs.if_) && constValue(f0, v0)) {
+      Object::ref rest = c2;
+      Object::ref body = cdr(f1);
+      if (v0 != Object::nil() && body != Object::nil()) {
+        Object::ref tail = body;
+        while (cdr(tail) != Object::nil())
+          tail = cdr(tail);
+        scdr(tail, rest);
+        rest = body;
+      }
+      if (first)
+        stack[head] = rest;
+      else
+        scdr(stack.top(), rest);
+      step_back(stack, head);
+      continue;
+    }
+
+    // two constants followed by arithmetic: evaluate it now, with
+    // the same code the bytecode would run
+    if (c2 != Object::nil() && constValue(f0, v0) && constValue(f1, v1)) {
+      Object::ref f2 = car(c2);
+      fold_fn fn = NULL;
+      if (maybe_type<Cons>(f2) && cdr(f2) == Object::nil() &&
+          is_a<Symbol*>(car(f2))) {
+        Opcode const* o = find(as_a<Symbol*>(car(f2)));
+        if (o)
+          fn = o->fold;
+      }
+      if (fn) {
+        size_t depth = stack.size();
+        stack.push(v0);
+        stack.push(v1);
+        bool ok = true;
+        try {
+          (*fn)(proc, stack);
+        } catch (HlError&) {
+          // leave it to fail at run time
+          ok = false;
+        }
+        // a BigInt has no literal form: compute it at run time
+        if (ok && maybe_type<BigInt>(stack.top()))
+          ok = false;
+        if (ok) {
+          // build the form pushing the result
+          Object::ref r = stack.top();
+          if (r == Object::nil() || r == Object::t()) {
+            stack.top() = Object::to_ref(
+              r == Object::nil() ? fs.lit_nil : fs.lit_t);
+          } else {
+            stack.top() = Object::to_ref(is_a<int>(r) ? fs.int_ : fs.float_);
+            stack.push(r);
+          }
+          stack.push(Object::nil());
+          while (stack.size() > depth + 1)
+            bytecode_cons(proc, stack);
+          cell = first ? stack[head] : cdr(stack.top(2));
+          scar(cell, stack.top());
+          scdr(cell, cdr(cdr(cdr(cell))));
+        }
+        stack.pop(stack.size() - depth);
+        if (ok) {
+          step_back(stack, head);
+          continue;
+        }
+      }
+    }
+
+    // optimize the body of an 'if, once, as it is passed
+    if (is_op(f0, fs.if_) && cdr(f0) != Object::nil()) {
+      stack.push(cdr(f0));
+      optimize(proc);
+      cell = first ? stack[head] : cdr(stack.top(2));
+      // an 'if must keep a body, and the old one is still valid
+      if (stack.top() != Object::nil())
+        scdr(car(cell), stack.top());
+      stack.pop();
+    }
+    stack.push(cell);
+  }
+  stack.pop(stack.size() - head - 1);
+}
+
+/*
+ * Only the first bytecode of a fused run is rewritten: the rest of
+ * the run is left as it is, holding the arguments the fused bytecode
+ * reads.  So a jmp-nil landing inside a run still executes the
+ * original bytecodes, and the disassembler can show the original
+ * forms by mapping the fused bytecode back to the first one.
+ */
+void Assembler::fuse(Bytecode *b) {
+  bytecode_t *code = b->getCode();
+  size_t len = b->getLen();
+  size_t i = 0;
+  while (i < len) {
+    size_t n = 1;
+    for (std::vector<Fusion>::iterator f = fusions.begin();
+         f != fusions.end(); ++f) {
+      size_t m = f->seq.size();
+      if (i + m > len) continue;
+      size_t j = 0;
+      while (j < m && code[i+j].op == f->seq[j]) ++j;
+      if (j == m) {
+        code[i].op = f->fused;
+        n = m;
+        break;
+      }
+    }
+    i += n;
+  }
+}
+
+void Assembler::regFusion(Fusion const& f) {
+  std::vector<Fusion>::iterator it = fusions.begin();
+  while (it != fusions.end() && it->seq.size() >= f.seq.size()) ++it;
+  fusions.insert(it, f);
+  intern(f.fused).original = f.seq[0];
+}
+
+void Assembler::regFusion(_bytecode_label fused,
+                          _bytecode_label a, _bytecode_label b) {
+  Fusion f;
+  f.fused = fused;
+  f.seq.push_back(a);
+  f.seq.push_back(b);
+  regFusion(f);
+}
+
+void Assembler::regFusion(_bytecode_label fused,
+                          _bytecode_label a, _bytecode_label b,
+                          _bytecode_label c) {
+  Fusion f;
+  f.fused = fused;
+  f.seq.push_back(a);
+  f.seq.push_back(b);
+  f.seq.push_back(c);
+  regFusion(f);
+}
+
+void Assembler::regFusion(_bytecode_label fused,
+                          _bytecode_label a, _bytecode_label b,
+                          _bytecode_label c, _bytecode_label d) {
+  Fusion f;
+  f.fused = fused;
+  f.seq.push_back(a);
+  f.seq.push_back(b);
+  f.seq.push_back(c);
+  f.seq.push_back(d);
+  regFusion(f);
 }
 
 void Assembler::goBack(Process & proc, size_t start, size_t end) {
@@ -205,11 +451,12 @@ void Assembler::goBack(Process & proc, size_t start, size_t end) {
 
   while (start < end) {
     bytecode_t b = expect_type<Bytecode>(proc.stack.top())->getCode()[start];
-    lbl_op_tbl::iterator op = inv_tbl.find(b.op);
-    if (op==inv_tbl.end()) {
+    b.op = original(b.op);
+    Opcode const* op = find(b.op);
+    if (!op || !op->disas) {
       // default behavior
       Cons *c = proc.create<Cons>();
-      c->scar(Object::to_ref(inv_bytetb[b.op]));
+      c->scar(Object::to_ref(name(b.op)));
       proc.stack.push(Object::to_ref(c));
       switch (argType(b.op)) {
       case ARG_INT:
@@ -228,13 +475,21 @@ void Assembler::goBack(Process & proc, size_t start, size_t end) {
           scdr(proc.stack.top(), Object::to_ref(c2));      
         }
         break;
+      case ARG_EXECUTOR:
+        {
+          Cons *c2 = proc.create<Cons>();
+          c2->scar(Object::to_ref(((Executor*)b.val)->getName()));
+          c2->scdr(Object::nil());
+          scdr(proc.stack.top(), Object::to_ref(c2));
+        }
+        break;
       default:
         c->scdr(Object::nil());
         break;
       }
       start++;
     } else {
-      start = op->second->disassemble(proc, start);
+      start = op->disas->disassemble(proc, start);
     }
 
     // append instruction at the end
@@ -255,15 +510,76 @@ void Assembler::goBack(Process & proc, size_t start, size_t end) {
   proc.stack.push(head);
 }
 
-bytecode_arg_type Assembler::argType(_bytecode_label lbl) {
-  if (op_args.find(lbl)!=op_args.end())
-    return op_args[lbl];
-  else
-    return ARG_NONE; // default to ARG_NONE
+OpcodeIndex::OpcodeIndex() : slots(64), used(0) {
+  for (size_t i = 0; i < slots.size(); ++i)
+    slots[i].op = none;
+}
+
+void OpcodeIndex::grow() {
+  std::vector<Slot> old(slots.size() * 2);
+  old.swap(slots);
+  for (size_t i = 0; i < slots.size(); ++i)
+    slots[i].op = none;
+  used = 0;
+  for (size_t i = 0; i < old.size(); ++i) {
+    if (old[i].op != none)
+      insert(old[i].key, old[i].op);
+  }
+}
+
+void OpcodeIndex::insert(uintptr_t key, size_t op) {
+  // keep it at most half full, so that probes stay short
+  if (2 * (used + 1) > slots.size())
+    grow();
+  size_t mask = slots.size() - 1;
+  size_t i = home(key) & mask;
+  while (slots[i].op != none && slots[i].key != key)
+    i = (i + 1) & mask;
+  if (slots[i].op == none)
+    ++used;
+  slots[i].key = key;
+  slots[i].op = op;
+}
+
+Assembler::Opcode& Assembler::intern(Symbol *s) {
+  size_t i = opcode(s);
+  if (i == OpcodeIndex::none) {
+    Opcode o = { s, NULL_BYTECODE, ARG_NONE, NULL, NULL, NULL_BYTECODE, NULL };
+    i = ops.size();
+    ops.push_back(o);
+    by_name.insert((uintptr_t) s, i);
+  }
+  return ops[i];
+}
+
+Assembler::Opcode& Assembler::intern(_bytecode_label lbl) {
+  size_t i = opcode(lbl);
+  if (i == OpcodeIndex::none) {
+    Opcode o = { NULL, lbl, ARG_NONE, NULL, NULL, lbl, NULL };
+    i = ops.size();
+    ops.push_back(o);
+    by_label.insert((uintptr_t) lbl, i);
+  }
+  return ops[i];
+}
+
+void Assembler::regBytecode(Symbol *s, _bytecode_label lbl,
+                            bytecode_arg_type tp) {
+  Opcode& o = intern(s);
+  o.label = lbl;
+  o.original = lbl;
+  o.arg = tp;
+  by_label.insert((uintptr_t) lbl, &o - &ops[0]);
 }
 
-void Assembler::regArg(_bytecode_label lbl, bytecode_arg_type tp) {
-  op_args[lbl] = tp;
+_bytecode_label Assembler::label(Symbol *s) const {
+  Opcode const* o = find(s);
+  if (!o || o->label == NULL_BYTECODE) {
+    std::string err = "assemble: unknown bytecode form: ";
+    err += s->getPrintName();
+    throw_HlError(err.c_str());
+  }
+  return o->label;
 }
 
 intptr_t Assembler::simpleVal(Object::ref sa) {
@@ -277,8 +593,27 @@ intptr_t Assembler::simpleVal(Object::ref sa) {
   }
 }
 
+intptr_t Assembler::simpleVal(Opcode const& o, Object::ref sa) {
+  if (o.arg == ARG_EXECUTOR) {
+    // resolved now, so that running it needs no lookup
+    Executor *e = NULL;
+    if (is_a<Symbol*>(sa))
+      e = Executor::findExecutor(as_a<Symbol*>(sa));
+    if (!e) {
+      std::string err("assemble: couldn't find executor: ");
+      if (is_a<Symbol*>(sa))
+        err += as_a<Symbol*>(sa)->getPrintName();
+      throw_HlError(err.c_str());
+    }
+    return (intptr_t) e;
+  }
+  return simpleVal(sa);
+}
+
 bool Assembler::isComplexConst(Object::ref obj) {
-  return maybe_type<Cons>(obj) || maybe_type<Float>(obj);
+  // a BigInt can't be an int argument: it may move in a GC
+  return maybe_type<Cons>(obj) || is_float(obj) ||
+    maybe_type<BigInt>(obj);
 }
 
 // count the number of complex constants 
@@ -302,15 +637,20 @@ size_t Assembler::countConsts(Object::ref seq) {
 }
 
 AsOp* Assembler::get_operation(Symbol *s) {
-	sym_op_tbl::iterator op = tbl.find(s);
-	if (op!=tbl.end()) {
-		return op->second;
-	} else {
-		return NULL;
-	}
+	Opcode const* o = find(s);
+	return o ? o->as : NULL;
 }
 
 bool AssemblerExecutor::run(Process & proc, size_t & reductions) {
+	std::string key;
+	if (AssemblyCache::capacity &&
+			AssemblyCache::key_of(proc.stack.top(), key)) {
+		if (asm_cache.lookup(proc, key))
+			return false;
+		assembler.go(proc);
+		asm_cache.insert(proc, key);
+		return false;
+	}
 	assembler.go(proc);
 	return false;
 }
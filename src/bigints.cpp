@@ -0,0 +1,411 @@
+#include"all_defines.hpp"
+
+#include"bigints.hpp"
+#include"types.hpp"
+#include"bytecodes.hpp"
+
+#include<algorithm>
+
+/*-----------------------------------------------------------------------------
+Magnitudes
+-----------------------------------------------------------------------------*/
+
+static inline void trim(Limbs& x) {
+	while(!x.empty() && x.back() == 0) x.pop_back();
+}
+
+static Limbs slice(limb_t const* p, size_t n) {
+	while(n && p[n - 1] == 0) --n;
+	return Limbs(p, p + n);
+}
+
+static int compare_mag(Limbs const& a, Limbs const& b) {
+	if(a.size() != b.size()) return a.size() < b.size() ? -1 : 1;
+	for(size_t i = a.size(); i; --i) {
+		if(a[i - 1] != b[i - 1]) return a[i - 1] < b[i - 1] ? -1 : 1;
+	}
+	return 0;
+}
+
+/*r += x * base^shift*/
+static void add_shifted(Limbs& r, Limbs const& x, size_t shift) {
+	if(x.empty()) return;
+	if(r.size() < x.size() + shift) r.resize(x.size() + shift, 0);
+	uint64_t carry = 0;
+	size_t i = 0;
+	for(; i < x.size(); ++i) {
+		uint64_t t = (uint64_t) r[i + shift] + x[i] + carry;
+		r[i + shift] = (limb_t) t;
+		carry = t >> 32;
+	}
+	for(i += shift; carry; ++i) {
+		if(i == r.size()) r.push_back(0);
+		uint64_t t = (uint64_t) r[i] + carry;
+		r[i] = (limb_t) t;
+		carry = t >> 32;
+	}
+}
+
+/*r -= x; r must not be less than x*/
+static void sub_in_place(Limbs& r, Limbs const& x) {
+	int64_t borrow = 0;
+	size_t i = 0;
+	for(; i < x.size(); ++i) {
+		int64_t t = (int64_t) r[i] - x[i] - borrow;
+		borrow = t < 0;
+		r[i] = (limb_t) t;
+	}
+	for(; borrow; ++i) {
+		int64_t t = (int64_t) r[i] - borrow;
+		borrow = t < 0;
+		r[i] = (limb_t) t;
+	}
+	trim(r);
+}
+
+static void mul_school(Limbs& r, limb_t const* a, size_t an,
+		limb_t const* b, size_t bn) {
+	r.assign(an + bn, 0);
+	for(size_t i = 0; i < an; ++i) {
+		uint64_t carry = 0;
+		for(size_t j = 0; j < bn; ++j) {
+			uint64_t t = (uint64_t) a[i] * b[j] + r[i + j] + carry;
+			r[i + j] = (limb_t) t;
+			carry = t >> 32;
+		}
+		r[i + bn] = (limb_t) carry;
+	}
+	trim(r);
+}
+
+static void mul_mag(Limbs& r, limb_t const* a, size_t an,
+		limb_t const* b, size_t bn) {
+	while(an && a[an - 1] == 0) --an;
+	while(bn && b[bn - 1] == 0) --bn;
+	if(an < bn) {
+		std::swap(a, b);
+		std::swap(an, bn);
+	}
+	if(bn < BigValue::karatsuba_threshold) {
+		mul_school(r, a, an, b, bn);
+		return;
+	}
+	size_t m = an / 2;
+	if(bn <= m) {
+		/*b is short: r = a0 b + a1 b base^m*/
+		Limbs hi;
+		mul_mag(r, a, m, b, bn);
+		mul_mag(hi, a + m, an - m, b, bn);
+		add_shifted(r, hi, m);
+		return;
+	}
+	/*a = a1 base^m + a0, b = b1 base^m + b0, and
+	a b = z2 base^2m + z1 base^m + z0, where
+	z1 = (a0 + a1)(b0 + b1) - z2 - z0
+	*/
+	Limbs z0, z1, z2;
+	mul_mag(z0, a, m, b, m);
+	mul_mag(z2, a + m, an - m, b + m, bn - m);
+	Limbs sa = slice(a, m);
+	add_shifted(sa, slice(a + m, an - m), 0);
+	Limbs sb = slice(b, m);
+	add_shifted(sb, slice(b + m, bn - m), 0);
+	mul_mag(z1, &sa[0], sa.size(), &sb[0], sb.size());
+	sub_in_place(z1, z2);
+	sub_in_place(z1, z0);
+	r.swap(z0);
+	add_shifted(r, z1, m);
+	add_shifted(r, z2, 2 * m);
+}
+
+/*divides in place by a single limb, returning the remainder*/
+static limb_t div_limb(Limbs& q, limb_t d) {
+	uint64_t rem = 0;
+	for(size_t i = q.size(); i; --i) {
+		uint64_t t = (rem << 32) | q[i - 1];
+		q[i - 1] = (limb_t) (t / d);
+		rem = t % d;
+	}
+	trim(q);
+	return (limb_t) rem;
+}
+
+/*multiplies in place by a single limb, then adds another*/
+static void mul_add_limb(Limbs& x, limb_t m, limb_t a) {
+	uint64_t carry = a;
+	for(size_t i = 0; i < x.size(); ++i) {
+		uint64_t t = (uint64_t) x[i] * m + carry;
+		x[i] = (limb_t) t;
+		carry = t >> 32;
+	}
+	if(carry) x.push_back((limb_t) carry);
+}
+
+/*Knuth's algorithm D, as given in Hacker's Delight*/
+static void divmod_mag(Limbs& q, Limbs& r, Limbs const& a, Limbs const& b) {
+	if(compare_mag(a, b) < 0) {
+		q.clear();
+		r = a;
+		return;
+	}
+	size_t n = b.size();
+	if(n == 1) {
+		q = a;
+		limb_t rem = div_limb(q, b[0]);
+		r.clear();
+		if(rem) r.push_back(rem);
+		return;
+	}
+	size_t m = a.size() - n;
+	/*normalize, so that the top limb of the divisor has
+	its high bit set
+	*/
+	int s = 0;
+	while(!(b[n - 1] & (((limb_t) 1) << (31 - s)))) ++s;
+	Limbs vn(n), un(a.size() + 1);
+	for(size_t i = n - 1; i > 0; --i) {
+		vn[i] = (limb_t) ((b[i] << s) |
+			((uint64_t) b[i - 1] >> (32 - s)));
+	}
+	vn[0] = b[0] << s;
+	un[a.size()] = (limb_t) ((uint64_t) a[a.size() - 1] >> (32 - s));
+	for(size_t i = a.size() - 1; i > 0; --i) {
+		un[i] = (limb_t) ((a[i] << s) |
+			((uint64_t) a[i - 1] >> (32 - s)));
+	}
+	un[0] = a[0] << s;
+
+	uint64_t const base = ((uint64_t) 1) << 32;
+	q.assign(m + 1, 0);
+	for(size_t j = m + 1; j--; ) {
+		uint64_t num = ((uint64_t) un[j + n] << 32) | un[j + n - 1];
+		uint64_t qhat = num / vn[n - 1];
+		uint64_t rhat = num % vn[n - 1];
+		while(qhat >= base ||
+				qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2])) {
+			--qhat;
+			rhat += vn[n - 1];
+			if(rhat >= base) break;
+		}
+		/*multiply and subtract*/
+		int64_t k = 0;
+		int64_t t;
+		for(size_t i = 0; i < n; ++i) {
+			uint64_t p = qhat * vn[i];
+			t = (int64_t) un[i + j] - k - (int64_t) (p & 0xFFFFFFFF);
+			un[i + j] = (limb_t) t;
+			k = (int64_t) (p >> 32) - (t >> 32);
+		}
+		t = (int64_t) un[j + n] - k;
+		un[j + n] = (limb_t) t;
+		q[j] = (limb_t) qhat;
+		/*subtracted too much: add back*/
+		if(t < 0) {
+			--q[j];
+			uint64_t c = 0;
+			for(size_t i = 0; i < n; ++i) {
+				uint64_t u = (uint64_t) un[i + j] + vn[i] + c;
+				un[i + j] = (limb_t) u;
+				c = u >> 32;
+			}
+			un[j + n] = (limb_t) (un[j + n] + c);
+		}
+	}
+	trim(q);
+	/*unnormalize the remainder*/
+	r.resize(n);
+	for(size_t i = 0; i < n; ++i) {
+		r[i] = (limb_t) ((un[i] >> s) |
+			((uint64_t) un[i + 1] << (32 - s)));
+	}
+	trim(r);
+}
+
+/*-----------------------------------------------------------------------------
+BigValue
+-----------------------------------------------------------------------------*/
+
+BigValue::BigValue(intptr_t x) : neg(x < 0), mag() {
+	uint64_t u = neg ? -(uint64_t) x : (uint64_t) x;
+	while(u) {
+		mag.push_back((limb_t) u);
+		u >>= 32;
+	}
+}
+
+bool BigValue::to_intptr(intptr_t& x) const {
+	if(mag.size() * sizeof(limb_t) > sizeof(uint64_t)) return false;
+	uint64_t u = 0;
+	for(size_t i = mag.size(); i; --i) u = (u << 32) | mag[i - 1];
+	if(neg) {
+		if(u > (uint64_t) INTPTR_MAX + 1) return false;
+		x = (intptr_t) -u;
+	} else {
+		if(u > (uint64_t) INTPTR_MAX) return false;
+		x = (intptr_t) u;
+	}
+	return true;
+}
+
+double BigValue::to_double(void) const {
+	double d = 0.0;
+	for(size_t i = mag.size(); i; --i) {
+		d = d * 4294967296.0 + mag[i - 1];
+	}
+	return neg ? -d : d;
+}
+
+std::string BigValue::to_string(void) const {
+	if(is_zero()) return "0";
+	std::string digits;
+	Limbs x = mag;
+	while(!x.empty()) {
+		/*nine digits at a time*/
+		limb_t chunk = div_limb(x, 1000000000);
+		for(int i = 0; i < 9; ++i) {
+			digits += (char) ('0' + chunk % 10);
+			chunk /= 10;
+			if(x.empty() && chunk == 0) break;
+		}
+	}
+	if(neg) digits += '-';
+	std::reverse(digits.begin(), digits.end());
+	return digits;
+}
+
+bool BigValue::from_string(std::string const& s, BigValue& r) {
+	size_t i = (!s.empty() && s[0] == '-') ? 1 : 0;
+	if(i == s.size()) return false;
+	r.mag.clear();
+	for(; i < s.size(); ++i) {
+		if(s[i] < '0' || s[i] > '9') return false;
+		mul_add_limb(r.mag, 10, s[i] - '0');
+	}
+	trim(r.mag);
+	r.neg = s[0] == '-' && !r.is_zero();
+	return true;
+}
+
+int BigValue::compare(BigValue const& a, BigValue const& b) {
+	if(a.neg != b.neg) return a.neg ? -1 : 1;
+	int c = compare_mag(a.mag, b.mag);
+	return a.neg ? -c : c;
+}
+
+void BigValue::add(BigValue& r, BigValue const& a, BigValue const& b) {
+	if(a.neg == b.neg) {
+		r.mag = a.mag;
+		add_shifted(r.mag, b.mag, 0);
+		r.neg = a.neg;
+	} else if(compare_mag(a.mag, b.mag) >= 0) {
+		r.mag = a.mag;
+		sub_in_place(r.mag, b.mag);
+		r.neg = a.neg;
+	} else {
+		r.mag = b.mag;
+		sub_in_place(r.mag, a.mag);
+		r.neg = b.neg;
+	}
+	if(r.is_zero()) r.neg = 0;
+}
+
+void BigValue::sub(BigValue& r, BigValue const& a, BigValue const& b) {
+	BigValue nb(b);
+	nb.neg = !b.neg && !b.is_zero();
+	add(r, a, nb);
+}
+
+void BigValue::mul(BigValue& r, BigValue const& a, BigValue const& b) {
+	if(a.is_zero() || b.is_zero()) {
+		r = BigValue();
+		return;
+	}
+	mul_mag(r.mag, &a.mag[0], a.mag.size(), &b.mag[0], b.mag.size());
+	r.neg = a.neg != b.neg;
+}
+
+void BigValue::divmod(BigValue& q, BigValue& m,
+		BigValue const& a, BigValue const& b) {
+	divmod_mag(q.mag, m.mag, a.mag, b.mag);
+	q.neg = (a.neg != b.neg) && !q.is_zero();
+	m.neg = a.neg && !m.is_zero();
+}
+
+/*-----------------------------------------------------------------------------
+BigInt
+-----------------------------------------------------------------------------*/
+
+Object::ref BigInt::mk(Heap & h, BigValue const& v) {
+	intptr_t x;
+	if(v.to_intptr(x) &&
+			x >= Object::smallint_min && x <= Object::smallint_max) {
+		return Object::to_ref((int) x);
+	}
+	size_t words = (v.mag.size() * sizeof(limb_t) +
+		sizeof(Object::ref) - 1) / sizeof(Object::ref);
+	BigInt* bp = h.create_variadic<BigInt>(words);
+	bp->neg = v.neg;
+	bp->len = v.mag.size();
+	std::copy(v.mag.begin(), v.mag.end(), bp->limbs());
+	return Object::to_ref<Generic*>(bp);
+}
+
+double BigInt::to_double(void) const {
+	BigValue v;
+	value(v);
+	return v.to_double();
+}
+
+bool BigInt::is(Object::ref o) const {
+	BigInt* bp = maybe_type<BigInt>(o);
+	if(!bp || bp->neg != neg || bp->len != len) return false;
+	return std::equal(limbs(), limbs() + len, bp->limbs());
+}
+
+void BigInt::enhash(HashingClass* hc) const {
+	hc->enhash(neg);
+	for(size_t i = 0; i < len; ++i) {
+		hc->enhash(limbs()[i]);
+	}
+}
+
+/*-----------------------------------------------------------------------------
+Integer bytecodes
+-----------------------------------------------------------------------------*/
+
+void bytecode_integer_op(Process & p, ProcessStack & stack,
+		IntegerOp op, char const* err) {
+	Object::ref a = stack.top(2);
+	Object::ref b = stack.top();
+	if(!is_integer(a) || !is_integer(b)) throw_HlError(err);
+	/*read both before allocating: a GC would move them*/
+	BigValue va, vb, r, m;
+	integer_value(a, va);
+	integer_value(b, vb);
+	switch(op) {
+	case integer_plus:
+		BigValue::add(r, va, vb);
+		break;
+	case integer_minus:
+		BigValue::sub(r, va, vb);
+		break;
+	case integer_mul:
+		BigValue::mul(r, va, vb);
+		break;
+	case integer_div:
+	case integer_mod:
+		if(vb.is_zero()) throw_HlError("division by zero");
+		BigValue::divmod(r, m, va, vb);
+		if(op == integer_mod) r = m;
+		break;
+	case integer_less:
+		stack.pop();
+		stack.top() =
+			BigValue::compare(va, vb) < 0 ?		Object::t() :
+			/*otherwise*/				Object::nil() ;
+		return;
+	}
+	Object::ref x = BigInt::mk(p, r);
+	stack.pop();
+	stack.top() = x;
+}
@@ -0,0 +1,851 @@
+#include"all_defines.hpp"
+
+#include"binaries.hpp"
+#include"assembler.hpp"
+#include"processes.hpp"
+#include"symbols.hpp"
+#include"types.hpp"
+
+#include<map>
+#include<cstring>
+#include<fstream>
+#include<iostream>
+
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/mman.h>
+#include<fcntl.h>
+#include<unistd.h>
+
+static char const hlb_magic[4] = {'H', 'L', 'B', '1'};
+static char const image_magic[4] = {'H', 'L', 'I', '1'};
+
+bool is_hlb(std::vector<char> const& dat) {
+	return dat.size() >= sizeof(hlb_magic) &&
+		std::memcmp(&dat[0], hlb_magic, sizeof(hlb_magic)) == 0;
+}
+
+/*-----------------------------------------------------------------------------
+Writing
+-----------------------------------------------------------------------------*/
+
+namespace {
+
+class HlbWriter {
+private:
+	/*the bodies go here, and are written after the symbols
+	they use are known
+	*/
+	std::string out;
+	std::vector<Symbol*> syms;
+	std::map<Symbol*, uint32_t> sym_index;
+	std::map<Bytecode*, uint32_t> body_index;
+
+	/*the objects of the global being written to an image,
+	which may be shared or cyclic
+	*/
+	std::vector<Generic*> objs;
+	std::map<Generic*, uint32_t> obj_index;
+	/*the globals of an image*/
+	std::string globals;
+	uint32_t nglobals;
+
+	void u8(unsigned char x) { out += (char) x; }
+	/*seven bits at a time, the lowest first*/
+	void u32(uint32_t x) {
+		while(x >= 0x80) {
+			u8((x & 0x7f) | 0x80);
+			x >>= 7;
+		}
+		u8(x);
+	}
+	/*zigzag, so that small negative numbers stay short*/
+	void i64(int64_t x) {
+		uint64_t z = ((uint64_t) x << 1) ^ (uint64_t) (x >> 63);
+		while(z >= 0x80) {
+			u8((z & 0x7f) | 0x80);
+			z >>= 7;
+		}
+		u8(z);
+	}
+	void u64(uint64_t x) {
+		for(size_t i = 0; i < 8; ++i) u8((x >> (8 * i)) & 0xff);
+	}
+	void sym(Symbol* s) {
+		std::map<Symbol*, uint32_t>::iterator it = sym_index.find(s);
+		if(it == sym_index.end()) {
+			it = sym_index.insert(
+				std::make_pair(s, (uint32_t) syms.size())).first;
+			syms.push_back(s);
+		}
+		u32(it->second);
+	}
+	void datum(Object::ref);
+	uint32_t body(Bytecode&);
+
+	void visit(Object::ref);
+	void value(Object::ref);
+	void contents(Generic*);
+
+public:
+	HlbWriter(void) : nglobals(0) { }
+	void write(std::ostream&, Bytecode&);
+	void global(Symbol*, Object::ref);
+	void write_image(std::ostream&);
+};
+
+/*the non-nil entries of a table*/
+void table_pairs(HlTable& T,
+		std::vector<std::pair<Object::ref, Object::ref> >& pairs) {
+	if(T.tbtype == hl_table_empty) return;
+	HlArray& A = *known_type<HlArray>(T.impl);
+	switch(T.tbtype) {
+	case hl_table_linear:
+		for(size_t i = 0; i < T.pairs; ++i) {
+			if(A[i * 2 + 1]) {
+				pairs.push_back(std::make_pair(A[i * 2], A[i * 2 + 1]));
+			}
+		}
+		break;
+	case hl_table_arrayed:
+		for(size_t i = 0; i < A.size(); ++i) {
+			if(A[i]) {
+				pairs.push_back(std::make_pair(
+					Object::to_ref((int) i), A[i]));
+			}
+		}
+		break;
+	case hl_table_hashed:
+		for(size_t i = 0; i < A.size(); ++i) {
+			Cons* c = maybe_type<Cons>(A[i]);
+			if(c && c->cdr()) {
+				pairs.push_back(std::make_pair(c->car(), c->cdr()));
+			}
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/*the references an image object holds, in the order written;
+the keys and values of a table alternate
+*/
+void children(Generic* g, std::vector<Object::ref>& refs) {
+	Object::ref o = Object::to_ref(g);
+	Cons* c;
+	Closure* k;
+	HlArray* a;
+	HlTable* h;
+	HlTagged* tg;
+	if((c = maybe_type<Cons>(o))) {
+		refs.push_back(c->car());
+		refs.push_back(c->cdr());
+	} else if((k = maybe_type<Closure>(o))) {
+		refs.push_back(k->code());
+		for(size_t i = 0; i < k->size(); ++i) refs.push_back((*k)[i]);
+	} else if((a = maybe_type<HlArray>(o))) {
+		for(size_t i = 0; i < a->size(); ++i) refs.push_back((*a)[i]);
+	} else if((h = maybe_type<HlTable>(o))) {
+		std::vector<std::pair<Object::ref, Object::ref> > pairs;
+		table_pairs(*h, pairs);
+		for(size_t i = 0; i < pairs.size(); ++i) {
+			refs.push_back(pairs[i].first);
+			refs.push_back(pairs[i].second);
+		}
+	} else if((tg = maybe_type<HlTagged>(o))) {
+		refs.push_back(tg->o_type);
+		refs.push_back(tg->o_rep);
+	}
+}
+
+}
+
+void HlbWriter::datum(Object::ref o) {
+	Cons* c;
+	BigInt* bi;
+	HlString* hs;
+	if(o == Object::nil()) {
+		u8('n');
+	} else if(o == Object::t()) {
+		u8('t');
+	} else if(is_a<int>(o)) {
+		u8('i');
+		i64(as_a<int>(o));
+	} else if(is_float(o)) {
+		u8('f');
+		u64(Object::double_to_bits(float_value(o)));
+	} else if(is_a<Symbol*>(o)) {
+		u8('s');
+		sym(as_a<Symbol*>(o));
+	} else if(is_a<UnicodeChar>(o)) {
+		u8('C');
+		u32(as_a<UnicodeChar>(o).dat);
+	} else if((hs = maybe_type<HlString>(o))) {
+		std::string str = hs->to_cpp_string();
+		u8('"');
+		u32(str.size());
+		out += str;
+	} else if((bi = maybe_type<BigInt>(o))) {
+		BigValue v;
+		bi->value(v);
+		u8('I');
+		std::string digits = v.to_string();
+		u32(digits.size());
+		out += digits;
+	} else if((c = maybe_type<Cons>(o))) {
+		u8('c');
+		datum(c->car());
+		datum(c->cdr());
+	} else {
+		throw_HlError("emit-hlb: can't write a constant of this type");
+	}
+}
+
+uint32_t HlbWriter::body(Bytecode& b) {
+	std::map<Bytecode*, uint32_t>::iterator it = body_index.find(&b);
+	if(it != body_index.end()) return it->second;
+	/*the bodies closed over come first*/
+	size_t slots = b.size();
+	for(size_t i = 0; i < slots; ++i) {
+		Bytecode* nb = maybe_type<Bytecode>(b[i]);
+		if(nb) body(*nb);
+	}
+	u32(slots);
+	for(size_t i = 0; i < slots; ++i) {
+		Bytecode* nb = maybe_type<Bytecode>(b[i]);
+		if(nb) {
+			u8('b');
+			u32(body_index[nb]);
+		} else {
+			datum(b[i]);
+		}
+	}
+	datum(b.get_name());
+	datum(b.get_file());
+	datum(b.get_line());
+	bytecode_t const* code = b.getCode();
+	size_t len = b.getLen();
+	u32(len);
+	for(size_t i = 0; i < len; ++i) {
+		_bytecode_label op = assembler.original(code[i].op);
+		sym(assembler.name(op));
+		bytecode_arg_type tp = assembler.argType(op);
+		if(tp == ARG_SYMBOL) {
+			sym((Symbol*) code[i].val);
+		} else if(tp == ARG_EXECUTOR) {
+			sym(((Executor*) code[i].val)->getName());
+		} else {
+			i64(code[i].val);
+		}
+	}
+	uint32_t rv = body_index.size();
+	body_index[&b] = rv;
+	return rv;
+}
+
+void HlbWriter::write(std::ostream& o, Bytecode& b) {
+	body(b);
+	std::string bodies;
+	bodies.swap(out);
+	out.append(hlb_magic, sizeof(hlb_magic));
+	u32(syms.size());
+	for(size_t i = 0; i < syms.size(); ++i) {
+		std::string name = syms[i]->getPrintName();
+		u32(name.size());
+		out += name;
+	}
+	u32(body_index.size());
+	o.write(out.data(), out.size());
+	o.write(bodies.data(), bodies.size());
+}
+
+void write_hlb(std::ostream& o, Bytecode& b) {
+	HlbWriter w;
+	w.write(o, b);
+	if(!o) throw_HlError("emit-hlb: write error");
+}
+
+/*finds the objects and bodies reachable from o*/
+void HlbWriter::visit(Object::ref o) {
+	if(!is_a<Generic*>(o)) return;
+	Generic* g = as_a<Generic*>(o);
+	Bytecode* b;
+	Closure* k;
+	if((b = maybe_type<Bytecode>(o))) {
+		body(*b);
+	} else if(maybe_type<Float>(o) || maybe_type<BigInt>(o) ||
+			maybe_type<HlString>(o)) {
+		/*immutable, so written in place*/
+	} else if(((k = maybe_type<Closure>(o)) && !k->is_continuation()) ||
+			maybe_type<Cons>(o) || maybe_type<HlArray>(o) ||
+			maybe_type<HlTable>(o) || maybe_type<HlTagged>(o)) {
+		if(obj_index.find(g) == obj_index.end()) {
+			obj_index[g] = objs.size();
+			objs.push_back(g);
+		}
+	} else if(k) {
+		throw_HlError("can't save a continuation");
+	} else {
+		std::string err = "can't save a value of type ";
+		Object::ref t = type(o);
+		err += is_a<Symbol*>(t) ? as_a<Symbol*>(t)->getPrintName() : "?";
+		throw_HlError(err.c_str());
+	}
+}
+
+void HlbWriter::value(Object::ref o) {
+	if(is_a<Generic*>(o)) {
+		Generic* g = as_a<Generic*>(o);
+		std::map<Generic*, uint32_t>::iterator it = obj_index.find(g);
+		if(it != obj_index.end()) {
+			u8('o');
+			u32(it->second);
+			return;
+		}
+		Bytecode* b = maybe_type<Bytecode>(o);
+		if(b) {
+			u8('b');
+			u32(body_index[b]);
+			return;
+		}
+	}
+	datum(o);
+}
+
+void HlbWriter::contents(Generic* g) {
+	std::vector<Object::ref> refs;
+	children(g, refs);
+	if(maybe_type<HlTable>(Object::to_ref(g))) u32(refs.size() / 2);
+	for(size_t i = 0; i < refs.size(); ++i) value(refs[i]);
+}
+
+/*writes a global's value; throws, writing nothing, if it can't
+be saved
+*/
+void HlbWriter::global(Symbol* s, Object::ref o) {
+	objs.clear();
+	obj_index.clear();
+	size_t mark = out.size();
+	uint32_t nbodies = body_index.size();
+	try {
+		visit(o);
+		for(size_t i = 0; i < objs.size(); ++i) {
+			std::vector<Object::ref> refs;
+			children(objs[i], refs);
+			for(size_t j = 0; j < refs.size(); ++j) visit(refs[j]);
+		}
+	} catch(HlError&) {
+		/*drop the bodies written for it*/
+		out.resize(mark);
+		std::map<Bytecode*, uint32_t>::iterator it = body_index.begin();
+		while(it != body_index.end()) {
+			if(it->second >= nbodies) body_index.erase(it++);
+			else ++it;
+		}
+		throw;
+	}
+	out.swap(globals);
+	sym(s);
+	u32(objs.size());
+	for(size_t i = 0; i < objs.size(); ++i) {
+		Object::ref oi = Object::to_ref(objs[i]);
+		Closure* k;
+		HlArray* a;
+		if(maybe_type<Cons>(oi)) {
+			u8('c');
+		} else if((k = maybe_type<Closure>(oi))) {
+			u8('k');
+			u32(k->size());
+		} else if((a = maybe_type<HlArray>(oi))) {
+			u8('a');
+			u32(a->size());
+		} else if(maybe_type<HlTable>(oi)) {
+			u8('h');
+		} else {
+			u8('g');
+		}
+	}
+	/*tables are filled last, once the keys they hash are*/
+	for(size_t i = 0; i < objs.size(); ++i) {
+		if(!maybe_type<HlTable>(Object::to_ref(objs[i]))) {
+			contents(objs[i]);
+		}
+	}
+	for(size_t i = 0; i < objs.size(); ++i) {
+		if(maybe_type<HlTable>(Object::to_ref(objs[i]))) {
+			contents(objs[i]);
+		}
+	}
+	value(o);
+	out.swap(globals);
+	++nglobals;
+}
+
+void HlbWriter::write_image(std::ostream& o) {
+	std::string bodies;
+	bodies.swap(out);
+	out.append(image_magic, sizeof(image_magic));
+	u32(syms.size());
+	for(size_t i = 0; i < syms.size(); ++i) {
+		std::string name = syms[i]->getPrintName();
+		u32(name.size());
+		out += name;
+	}
+	u32(body_index.size());
+	o.write(out.data(), out.size());
+	o.write(bodies.data(), bodies.size());
+	out.clear();
+	u32(nglobals);
+	o.write(out.data(), out.size());
+	o.write(globals.data(), globals.size());
+}
+
+namespace {
+
+class GlobalsCollector : public SymbolsTableTraverser {
+public:
+	std::vector<Symbol*> bound;
+	virtual void traverse(Symbol* s) {
+		if(!s->unbounded()) bound.push_back(s);
+	}
+};
+
+}
+
+void save_image(std::string const& file) {
+	GlobalsCollector gc;
+	symbols->traverse_symbols(&gc);
+	HlbWriter w;
+	for(size_t i = 0; i < gc.bound.size(); ++i) {
+		Symbol* s = gc.bound[i];
+		ValueHolderRef v;
+		s->copy_value_to(v);
+		try {
+			w.global(s, v.value());
+		} catch(HlError& h) {
+			std::cerr << "save-image: not saving "
+				<< s->getPrintName() << ": " << h.err_str()
+				<< std::endl;
+		}
+	}
+	std::ofstream o(file.c_str(), std::ios::binary);
+	if(!o) throw_HlError(("save-image: can't open " + file).c_str());
+	w.write_image(o);
+	if(!o) throw_HlError("save-image: write error");
+}
+
+/*-----------------------------------------------------------------------------
+Loading
+-----------------------------------------------------------------------------*/
+
+namespace {
+
+class HlbLoader {
+private:
+	Process& proc;
+	char const* pt;
+	char const* end;
+	std::vector<Symbol*> syms;
+	/*the label of each symbol used as a bytecode name,
+	found when first used
+	*/
+	std::vector<_bytecode_label> labels;
+	std::vector<bool> has_label;
+	/*position of the first body on the stack*/
+	size_t base;
+
+	void need(size_t n) {
+		if((size_t) (end - pt) < n) {
+			throw_HlError("load-hlb: truncated file");
+		}
+	}
+	unsigned char u8(void) {
+		need(1);
+		return (unsigned char) *pt++;
+	}
+	uint32_t u32(void) {
+		uint32_t x = 0;
+		for(size_t shift = 0; shift < 35; shift += 7) {
+			unsigned char b = u8();
+			/*the fifth byte holds only the top four bits*/
+			if(shift == 28 && (b & 0x70)) break;
+			x |= (uint32_t) (b & 0x7f) << shift;
+			if(!(b & 0x80)) return x;
+		}
+		throw_HlError("load-hlb: bad number");
+		return 0;
+	}
+	/*a count of items that each take at least a byte, checked
+	before anything is allocated for them
+	*/
+	uint32_t count(void) {
+		uint32_t n = u32();
+		need(n);
+		return n;
+	}
+	int64_t i64(void) {
+		uint64_t z = 0;
+		for(size_t shift = 0; shift < 70; shift += 7) {
+			unsigned char b = u8();
+			/*the tenth byte holds only the top bit*/
+			if(shift == 63 && (b & 0x7e)) break;
+			z |= (uint64_t) (b & 0x7f) << shift;
+			if(!(b & 0x80)) return (int64_t) (z >> 1) ^ -(int64_t) (z & 1);
+		}
+		throw_HlError("load-hlb: bad number");
+		return 0;
+	}
+	uint64_t u64(void) {
+		need(8);
+		uint64_t x = 0;
+		for(size_t i = 0; i < 8; ++i) {
+			x |= ((uint64_t) (unsigned char) pt[i]) << (8 * i);
+		}
+		pt += 8;
+		return x;
+	}
+	std::string str(void) {
+		uint32_t n = u32();
+		need(n);
+		std::string rv(pt, n);
+		pt += n;
+		return rv;
+	}
+	Symbol* sym(void) {
+		uint32_t i = u32();
+		if(i >= syms.size()) throw_HlError("load-hlb: bad symbol");
+		return syms[i];
+	}
+	_bytecode_label label(void) {
+		uint32_t i = u32();
+		if(i >= syms.size()) throw_HlError("load-hlb: bad symbol");
+		if(!has_label[i]) {
+			Assembler::Opcode const* o = assembler.find(syms[i]);
+			if(!o || o->label == NULL_BYTECODE) {
+				std::string err = "load-hlb: unknown bytecode: ";
+				err += syms[i]->getPrintName();
+				throw_HlError(err.c_str());
+			}
+			labels[i] = o->label;
+			has_label[i] = 1;
+		}
+		return labels[i];
+	}
+	Bytecode* top_body(size_t off) {
+		return known_type<Bytecode>(proc.stack.top(off));
+	}
+	/*pushes a datum*/
+	void datum(void);
+	/*pushes a body*/
+	void body(size_t loaded);
+	void header(void);
+
+	/*position of the first object of the global being loaded*/
+	size_t obj_base;
+	size_t nobjs;
+	size_t nbodies;
+	/*pushes a value of a global*/
+	Object::ref& obj(size_t i) { return proc.stack[obj_base + i]; }
+	void value(void);
+	void global(void);
+
+public:
+	HlbLoader(Process& nproc, char const* nstart, char const* nend)
+		: proc(nproc), pt(nstart), end(nend),
+		  syms(), labels(), has_label(), base(0),
+		  obj_base(0), nobjs(0), nbodies(0) { }
+	void load(void);
+	void load_image(void);
+};
+
+}
+
+void HlbLoader::datum(void) {
+	unsigned char tag = u8();
+	switch(tag) {
+	case 'n':
+		proc.stack.push(Object::nil());
+		break;
+	case 't':
+		proc.stack.push(Object::t());
+		break;
+	case 'i': {
+		int64_t x = i64();
+		if(x < Object::smallint_min || x > Object::smallint_max) {
+			throw_HlError("load-hlb: bad smallint");
+		}
+		proc.stack.push(Object::to_ref((int) x));
+	} break;
+	case 'f':
+		proc.stack.push(
+			Float::mk(proc, Object::bits_to_double(u64())));
+		break;
+	case 's':
+		proc.stack.push(Object::to_ref(sym()));
+		break;
+	case 'C':
+		proc.stack.push(Object::to_ref(UnicodeChar(u32())));
+		break;
+	case '"':
+		HlString::from_cpp_string(proc, proc.stack, str());
+		break;
+	case 'I': {
+		BigValue v;
+		if(!BigValue::from_string(str(), v)) {
+			throw_HlError("load-hlb: bad integer");
+		}
+		proc.stack.push(BigInt::mk(proc, v));
+	} break;
+	case 'c':
+		datum();
+		datum();
+		bytecode_cons(proc, proc.stack);
+		break;
+	default:
+		throw_HlError("load-hlb: bad constant");
+	}
+}
+
+void HlbLoader::body(size_t loaded) {
+	uint32_t slots = count();
+	proc.stack.push(Object::to_ref<Generic*>(
+		proc.create_variadic<Bytecode>(slots)));
+	for(uint32_t i = 0; i < slots; ++i) {
+		need(1);
+		if(*pt == 'b') {
+			++pt;
+			uint32_t j = u32();
+			if(j >= loaded) throw_HlError("load-hlb: bad body");
+			top_body(1)->closeOver(proc.stack[base + j]);
+		} else {
+			datum();
+			top_body(2)->closeOver(proc.stack.top());
+			proc.stack.pop();
+		}
+	}
+	datum();
+	Bytecode::set_name(top_body(2), proc.stack.top());
+	proc.stack.pop();
+	datum();
+	Bytecode::set_file(top_body(2), proc.stack.top());
+	proc.stack.pop();
+	datum();
+	Bytecode::set_line(top_body(2), proc.stack.top());
+	proc.stack.pop();
+	Bytecode* b = top_body(1);
+	uint32_t len = u32();
+	for(uint32_t i = 0; i < len; ++i) {
+		_bytecode_label op = label();
+		intptr_t val;
+		bytecode_arg_type tp = assembler.argType(op);
+		if(tp == ARG_SYMBOL) {
+			val = (intptr_t) sym();
+		} else if(tp == ARG_EXECUTOR) {
+			Symbol* s = sym();
+			Executor* e = Executor::findExecutor(s);
+			if(!e) {
+				std::string err = "load-hlb: unknown executor: ";
+				err += s->getPrintName();
+				throw_HlError(err.c_str());
+			}
+			val = (intptr_t) e;
+		} else {
+			val = (intptr_t) i64();
+		}
+		b->push(op, val);
+	}
+	assembler.finish(b);
+}
+
+void HlbLoader::header(void) {
+	pt += 4;
+	/*each symbol is looked up once, not once per use*/
+	uint32_t nsyms = count();
+	syms.reserve(nsyms);
+	for(uint32_t i = 0; i < nsyms; ++i) {
+		uint32_t n = u32();
+		need(n);
+		syms.push_back(symbols->lookup(pt, n));
+		pt += n;
+	}
+	labels.resize(nsyms);
+	has_label.resize(nsyms);
+	nbodies = u32();
+	base = proc.stack.size();
+	for(uint32_t i = 0; i < nbodies; ++i) {
+		body(i);
+	}
+}
+
+void HlbLoader::load(void) {
+	header();
+	if(nbodies == 0) throw_HlError("load-hlb: no bodies");
+	if(pt != end) throw_HlError("load-hlb: garbage at end of file");
+	/*keep only the last body*/
+	Object::ref rv = proc.stack.top();
+	proc.stack.pop(nbodies);
+	proc.stack.push(rv);
+}
+
+void HlbLoader::value(void) {
+	need(1);
+	if(*pt == 'o') {
+		++pt;
+		uint32_t i = u32();
+		if(i >= nobjs) throw_HlError("load-image: bad object");
+		proc.stack.push(obj(i));
+	} else if(*pt == 'b') {
+		++pt;
+		uint32_t j = u32();
+		if(j >= nbodies) throw_HlError("load-image: bad body");
+		proc.stack.push(proc.stack[base + j]);
+	} else {
+		datum();
+	}
+}
+
+void HlbLoader::global(void) {
+	Symbol* s = sym();
+	nobjs = count();
+	obj_base = proc.stack.size();
+	std::vector<unsigned char> kinds(nobjs);
+	std::vector<uint32_t> sizes(nobjs);
+	/*allocate every object first, so that they can refer
+	to each other in any order
+	*/
+	for(size_t i = 0; i < nobjs; ++i) {
+		kinds[i] = u8();
+		switch(kinds[i]) {
+		case 'c':
+			proc.stack.push(Object::to_ref<Generic*>(
+				proc.create<Cons>()));
+			break;
+		case 'k':
+			sizes[i] = count();
+			proc.stack.push(Object::to_ref(
+				Closure::NewClosure(proc, sizes[i])));
+			break;
+		case 'a':
+			sizes[i] = count();
+			proc.stack.push(Object::to_ref<Generic*>(
+				proc.create_variadic<HlArray>(sizes[i])));
+			break;
+		case 'h':
+			proc.stack.push(Object::to_ref<Generic*>(
+				proc.create<HlTable>()));
+			break;
+		case 'g':
+			proc.stack.push(Object::to_ref<Generic*>(
+				proc.create<HlTagged>()));
+			break;
+		default:
+			throw_HlError("load-image: bad object");
+		}
+	}
+	/*then fill them, the tables last*/
+	for(size_t i = 0; i < nobjs; ++i) {
+		switch(kinds[i]) {
+		case 'c':
+			value();
+			known_type<Cons>(obj(i))->scar(proc.stack.top());
+			proc.stack.pop();
+			value();
+			known_type<Cons>(obj(i))->scdr(proc.stack.top());
+			proc.stack.pop();
+			break;
+		case 'k':
+			value();
+			known_type<Closure>(obj(i))->codereset(proc.stack.top());
+			proc.stack.pop();
+			for(size_t j = 0; j < sizes[i]; ++j) {
+				value();
+				(*known_type<Closure>(obj(i)))[j] = proc.stack.top();
+				proc.stack.pop();
+			}
+			break;
+		case 'a':
+			for(size_t j = 0; j < sizes[i]; ++j) {
+				value();
+				(*known_type<HlArray>(obj(i)))[j] = proc.stack.top();
+				proc.stack.pop();
+			}
+			break;
+		case 'g':
+			value();
+			known_type<HlTagged>(obj(i))->o_type = proc.stack.top();
+			proc.stack.pop();
+			value();
+			known_type<HlTagged>(obj(i))->o_rep = proc.stack.top();
+			proc.stack.pop();
+			break;
+		}
+	}
+	for(size_t i = 0; i < nobjs; ++i) {
+		if(kinds[i] != 'h') continue;
+		uint32_t pairs = u32();
+		for(uint32_t j = 0; j < pairs; ++j) {
+			proc.stack.push(obj(i));
+			value();
+			value();
+			/*HlTable::insert wants the key on top*/
+			Object::ref tmp = proc.stack.top(1);
+			proc.stack.top(1) = proc.stack.top(2);
+			proc.stack.top(2) = tmp;
+			HlTable::insert(proc, proc.stack);
+			proc.stack.pop();
+		}
+	}
+	value();
+	s->set_value(proc.stack.top());
+	proc.stack.pop(nobjs + 1);
+}
+
+void HlbLoader::load_image(void) {
+	header();
+	uint32_t nglobals = u32();
+	for(uint32_t i = 0; i < nglobals; ++i) {
+		global();
+	}
+	if(pt != end) throw_HlError("load-image: garbage at end of file");
+	proc.stack.pop(nbodies);
+}
+
+void load_hlb(Process& proc, std::vector<char> const& dat) {
+	if(!is_hlb(dat)) throw_HlError("load-hlb: not a .hlb file");
+	HlbLoader l(proc, &dat[0], &dat[0] + dat.size());
+	l.load();
+}
+
+/*-----------------------------------------------------------------------------
+Images
+-----------------------------------------------------------------------------*/
+
+void load_image(Process& proc, std::string const& file) {
+	int fd = open(file.c_str(), O_RDONLY);
+	if(fd < 0) throw_HlError(("load-image: can't open " + file).c_str());
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(image_magic)) {
+		close(fd);
+		throw_HlError(("load-image: not an image: " + file).c_str());
+	}
+	size_t len = st.st_size;
+	void* mem = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(mem == MAP_FAILED) {
+		throw_HlError(("load-image: can't map " + file).c_str());
+	}
+	char const* start = (char const*) mem;
+	try {
+		if(std::memcmp(start, image_magic, sizeof(image_magic)) != 0) {
+			throw_HlError(("load-image: not an image: " + file).c_str());
+		}
+		HlbLoader l(proc, start, start + len);
+		l.load_image();
+	} catch(...) {
+		munmap(mem, len);
+		throw;
+	}
+	munmap(mem, len);
+}
+
@@ -9,29 +9,17 @@
 #include "workers.hpp"
 #include "obj_aio.hpp"
 #include "assembler.hpp"
+#include "asmcache.hpp"
+#include "jit.hpp"
+#include "profiles.hpp"
 
 #ifdef DEBUG
   #include <typeinfo>
 #endif
 #include <iostream>
 
-std::map<Symbol*,_bytecode_label> bytetb;
-std::map<_bytecode_label, Symbol*> inv_bytetb;
-
-
 ExecutorTable Executor::tbl;
 
-static _bytecode_label bytecodelookup(Symbol *s){
-	std::map<Symbol*, _bytecode_label>::iterator i = bytetb.find(s);
-	if(i != bytetb.end()){
-		return i->second;
-	} else {
-          std::string err = "assemble: unknown bytecode form: ";
-          err += s->getPrintName();
-          throw_HlError(err.c_str());
-	}
-}
-
 template<class E>
 static inline Executor* THE_EXECUTOR(void) {
 	return new E();
@@ -45,24 +33,21 @@ public:
 			char const* s,
 			_bytecode_label l,
                         bytecode_arg_type tp = ARG_NONE) const {
-                Symbol *opcode = symbols->lookup(s);
-		bytetb[opcode] = l;
-                inv_bytetb[l] = opcode;
-                assembler.regArg(l, tp);
+                assembler.regBytecode(symbols->lookup(s), l, tp);
 		return *this;
 	}
 	InitialAssignments const& operator()(
 			char const* s,
 			_bytecode_label l,
 			NON_STD) const {
-		(*this)(s, l);
+		return (*this)(s, l);
 	}
 	InitialAssignments const& operator()(
 			char const* s,
 			_bytecode_label l,
 			bytecode_arg_type tp,
 			NON_STD) const {
-		(*this)(s, l, tp);
+		return (*this)(s, l, tp);
 	}
 	InitialAssignments const& operator()(
 			char const* s,
@@ -106,6 +91,67 @@ public:
 		return true;
 	}
 };
+/*pushes (name . v), for an association list of metrics*/
+static void push_pair(Process& proc, char const* name, size_t v) {
+	/*saturate rather than overflow the smallint*/
+	if(v > (size_t) INT_MAX) v = INT_MAX;
+	proc.stack.push(Object::to_ref(symbols->lookup(name)));
+	proc.stack.push(Object::to_ref((int) v));
+	bytecode_cons(proc, proc.stack);
+}
+class SchedulerMetricsExecutor : public Executor {
+public:
+	bool run(Process& proc, size_t& reductions) {
+		/*given:
+			stack[0] = unused
+			stack[1] = k
+		calls k with an association list of scheduler
+		metrics, sampled now
+		*/
+		ProcessStack& stack = proc.stack;
+		SchedulerMetrics m = AllWorkers::getInstance().get_metrics();
+		push_pair(proc, "msec", m.usec / 1000);
+		push_pair(proc, "workqueue", m.workqueue);
+		push_pair(proc, "waitqueue", m.waitqueue);
+		push_pair(proc, "running", m.running);
+		push_pair(proc, "waiting", m.waiting);
+		push_pair(proc, "anesthesized", m.anesthesized);
+		push_pair(proc, "dead", m.dead);
+		push_pair(proc, "mailbox", m.mailbox);
+		push_pair(proc, "heap-kbytes", m.heap_bytes / 1024);
+		push_pair(proc, "code-kbytes", m.code_bytes / 1024);
+		push_pair(proc, "code-unshared", m.code_unshared);
+		stack.push(Object::nil());
+		for(size_t i = 0; i < 11; ++i) {
+			bytecode_cons(proc, stack);
+		}
+		stack.restack(2);
+		return true;
+	}
+};
+class AssembleCacheMetricsExecutor : public Executor {
+public:
+	bool run(Process& proc, size_t& reductions) {
+		/*given:
+			stack[0] = unused
+			stack[1] = k
+		calls k with an association list of the counts
+		of the assembly cache
+		*/
+		ProcessStack& stack = proc.stack;
+		AssemblyCache::Metrics m = asm_cache.get_metrics();
+		push_pair(proc, "hits", m.hits);
+		push_pair(proc, "misses", m.misses);
+		push_pair(proc, "evictions", m.evictions);
+		push_pair(proc, "entries", m.entries);
+		stack.push(Object::nil());
+		for(size_t i = 0; i < 4; ++i) {
+			bytecode_cons(proc, stack);
+		}
+		stack.restack(2);
+		return true;
+	}
+};
 class DisassemblerExecutor : public Executor {
 public:
 	bool run(Process& proc, size_t& reductions) {
@@ -142,12 +188,30 @@ void Bytecode::push(bytecode_t b) {
   code[nextCode++] = b;
 }
 
+static void free_code(bytecode_t *c) {
+  free(c);
+}
+
+void Bytecode::finalize() {
+  if (code.get()==NULL)
+    return;
+  void *mem;
+  if (posix_memalign(&mem, 64, nextCode * sizeof(bytecode_t)))
+    throw std::bad_alloc();
+  bytecode_t *nb = (bytecode_t*) mem;
+  bytecode_t *c = code.get();
+  for (size_t i = 0; i<nextCode; i++)
+    nb[i] = c[i];
+  code.reset(nb, &free_code);
+  codeSize = nextCode;
+}
+
 void Bytecode::push(_bytecode_label op, intptr_t val) {
   push((bytecode_t){op, val});
 }
 
 void Bytecode::push(Symbol *s, intptr_t val) {
-  push(bytecodelookup(s), val);
+  push(assembler.label(s), val);
 }
 
 void Bytecode::push(const char *s, intptr_t val) {
@@ -157,11 +221,13 @@ void Bytecode::push(const char *s, intptr_t val) {
 /*attempts to deallocate the specified object if it's a reusable
 continuation closure
 */
-static void attempt_kclos_dealloc(Heap& hp, Generic* gp) {
+static void attempt_kclos_dealloc(Process& proc, Generic* gp) {
 	Closure* kp = dynamic_cast<Closure*>(gp);
 	if(kp == NULL) return;
 	if(!kp->reusable()) return;
-	hp.lifo_dealloc(gp);
+	/*the history must not refer to the released memory*/
+	proc.history().release(Object::to_ref(gp));
+	proc.lifo_dealloc(gp);
 }
 
 #define CLOSUREREF Closure& clos = *known_type<Closure>(stack[0])
@@ -332,7 +398,7 @@ ProcessStatus execute(Process& proc, size_t& reductions, Process*& Q, bool init)
       ("<bc>type-local-push",	THE_BYTECODE_LABEL(type_local_push))
       ("<bc>type-clos-push",	THE_BYTECODE_LABEL(type_clos_push))
       ("<bc>variadic",		THE_BYTECODE_LABEL(variadic), ARG_INT)
-      ("<bc>do-executor",       THE_BYTECODE_LABEL(do_executor), ARG_SYMBOL,
+      ("<bc>do-executor",       THE_BYTECODE_LABEL(do_executor), ARG_EXECUTOR,
         NON_STD())
       ("<bc>i+",                    THE_BYTECODE_LABEL(iplus))
       ("<bc>i-",                    THE_BYTECODE_LABEL(iminus))
@@ -349,6 +415,8 @@ ProcessStatus execute(Process& proc, size_t& reductions, Process*& Q, bool init)
       ("<impl>is-symbol-packaged",	THE_EXECUTOR<IsSymbolPackaged>())
       ("<impl>assemble",		THE_EXECUTOR<AssemblerExecutor>())
       ("<impl>disassemble",		THE_EXECUTOR<DisassemblerExecutor>())
+      ("<impl>scheduler-metrics",	THE_EXECUTOR<SchedulerMetricsExecutor>())
+      ("<impl>assemble-cache-metrics",	THE_EXECUTOR<AssembleCacheMetricsExecutor>())
       ("<impl>go-next-boot",		THE_EXECUTOR<GoNextBoot>())
       /*assign bultin global*/
       ;/*end initializer*/
@@ -368,17 +436,75 @@ ProcessStatus execute(Process& proc, size_t& reductions, Process*& Q, bool init)
     assembler.reg<DbgInfoAs<&Bytecode::set_line> >(symbols->lookup("<bc>debug-line"), NULL_BYTECODE);
     assembler.reg<DbgInfoAs<&Bytecode::set_file> >(symbols->lookup("<bc>debug-file"), NULL_BYTECODE);
 
+    // bytecodes that can be evaluated on constants
+    assembler.regFold(symbols->lookup("<bc>i+"), &bytecode_iplus);
+    assembler.regFold(symbols->lookup("<bc>i-"), &bytecode_iminus);
+    assembler.regFold(symbols->lookup("<bc>i*"), &bytecode_imul);
+    assembler.regFold(symbols->lookup("<bc>i/"), &bytecode_idiv);
+    assembler.regFold(symbols->lookup("<bc>imod"), &bytecode_imod);
+    assembler.regFold(symbols->lookup("<bc>i<"), &bytecode_iless);
+    assembler.regFold(symbols->lookup("<bc>f+"), &bytecode_fplus);
+    assembler.regFold(symbols->lookup("<bc>f-"), &bytecode_fminus);
+    assembler.regFold(symbols->lookup("<bc>f*"), &bytecode_fmul);
+    assembler.regFold(symbols->lookup("<bc>f/"), &bytecode_fdiv);
+    assembler.regFold(symbols->lookup("<bc>f<"), &bytecode_fless);
+
+    // fused bytecodes for common runs
+    assembler.regFusion(THE_BYTECODE_LABEL(check_vars_local),
+      THE_BYTECODE_LABEL(check_vars), THE_BYTECODE_LABEL(local));
+    assembler.regFusion(THE_BYTECODE_LABEL(global_local),
+      THE_BYTECODE_LABEL(global), THE_BYTECODE_LABEL(local));
+    assembler.regFusion(THE_BYTECODE_LABEL(global_local_apply),
+      THE_BYTECODE_LABEL(global), THE_BYTECODE_LABEL(local),
+      THE_BYTECODE_LABEL(apply));
+    assembler.regFusion(THE_BYTECODE_LABEL(local_local),
+      THE_BYTECODE_LABEL(local), THE_BYTECODE_LABEL(local));
+    assembler.regFusion(THE_BYTECODE_LABEL(local_apply),
+      THE_BYTECODE_LABEL(local), THE_BYTECODE_LABEL(apply));
+    assembler.regFusion(THE_BYTECODE_LABEL(local_local_iplus),
+      THE_BYTECODE_LABEL(local), THE_BYTECODE_LABEL(local),
+      THE_BYTECODE_LABEL(iplus));
+    assembler.regFusion(THE_BYTECODE_LABEL(local_int_iplus),
+      THE_BYTECODE_LABEL(local), THE_BYTECODE_LABEL(b_int),
+      THE_BYTECODE_LABEL(iplus));
+    assembler.regFusion(THE_BYTECODE_LABEL(local_int_iminus),
+      THE_BYTECODE_LABEL(local), THE_BYTECODE_LABEL(b_int),
+      THE_BYTECODE_LABEL(iminus));
+    assembler.regFusion(THE_BYTECODE_LABEL(int_local_iless_jmp_nil),
+      THE_BYTECODE_LABEL(b_int), THE_BYTECODE_LABEL(local),
+      THE_BYTECODE_LABEL(iless), THE_BYTECODE_LABEL(jmp_nil));
+    assembler.regFusion(THE_BYTECODE_LABEL(local_int_iless_jmp_nil),
+      THE_BYTECODE_LABEL(local), THE_BYTECODE_LABEL(b_int),
+      THE_BYTECODE_LABEL(iless), THE_BYTECODE_LABEL(jmp_nil));
+
+#ifdef HAVE_JIT
+    jit.reg(THE_BYTECODE_LABEL(apply), jit_apply);
+    jit.reg(THE_BYTECODE_LABEL(check_vars), jit_check_vars);
+    jit.reg(THE_BYTECODE_LABEL(closure_ref), jit_closure_ref);
+    jit.reg(THE_BYTECODE_LABEL(b_continue), jit_continue);
+    jit.reg(THE_BYTECODE_LABEL(continue_local), jit_continue_local);
+    jit.reg(THE_BYTECODE_LABEL(global), jit_global);
+    jit.reg(THE_BYTECODE_LABEL(iless), jit_iless);
+    jit.reg(THE_BYTECODE_LABEL(iminus), jit_iminus);
+    jit.reg(THE_BYTECODE_LABEL(b_int), jit_int);
+    jit.reg(THE_BYTECODE_LABEL(iplus), jit_iplus);
+    jit.reg(THE_BYTECODE_LABEL(jmp_nil), jit_jmp_nil);
+    jit.reg(THE_BYTECODE_LABEL(lit_nil), jit_lit_nil);
+    jit.reg(THE_BYTECODE_LABEL(lit_t), jit_lit_t);
+    jit.reg(THE_BYTECODE_LABEL(local), jit_local);
+#endif
+
     /*
      * build and assemble various bytecode sequences
      * these will hold a fixed Bytecodes that will be used
      * as the continuations for various bytecodes
      */
-    symbols->lookup("<impl>reducto-cont-body")->
+    symbol_impl_body[impl_reducto_cont_body]->
       set_value(Assembler::inline_assemble(proc, 
         "(<bc>reducto-continuation) (<bc>continue)"));
-    symbols->lookup("<impl>ccc-fn-body")->
+    symbol_impl_body[impl_ccc_fn_body]->
       set_value(Assembler::inline_assemble(proc, "(<bc>check-vars 3) (<bc>continue-on-clos 0)"));
-    symbols->lookup("<impl>composeo-cont-body")->
+    symbol_impl_body[impl_composeo_cont_body]->
       set_value(Assembler::inline_assemble(proc,
         "(<bc>check-vars 2) "
         "(<bc>closure-ref 0) "
@@ -393,6 +519,10 @@ ProcessStatus execute(Process& proc, size_t& reductions, Process*& Q, bool init)
   // main VM loop
   // add bytecode as an extra root object to scan
   Object::ref& bytecode = proc.bytecode_slot;
+#ifdef BYTECODE_PROFILE
+  BytecodeProfile* prof = proc.profile;
+  if (prof) prof->start();
+#endif
   // ?? could this approach be used for clos too?
  call_current_closure:
 #ifdef BYTECODE_DEBUG
@@ -411,7 +541,7 @@ ProcessStatus execute(Process& proc, size_t& reductions, Process*& Q, bool init)
   }
 #endif
   // is this a function/continuation call?
-  {Closure *clos = maybe_type<Closure>(stack[0]);
+  {Closure *clos = maybe_exact_type<Closure>(stack[0]);
     if (!clos) {
       /*
       In hl, function calls of the form (f a b c),
@@ -451,8 +581,31 @@ ProcessStatus execute(Process& proc, size_t& reductions, Process*& Q, bool init)
     bytecode = clos->code();
   }
   proc.history().entry(); // enter a function
+#ifdef BYTECODE_PROFILE
+  if (prof) prof->enter(*known_type<Bytecode>(bytecode));
+#endif
+  size_t resume_at = 0;
+#ifdef HAVE_JIT
+  // run a hot body natively, for as far as its native code goes
+#ifdef BYTECODE_PROFILE
+  if (!prof)
+#endif
+  {Bytecode *b = known_type<Bytecode>(bytecode);
+    JitCode *native = b->getNative();
+    if (!native && b->heat(Jit::threshold)) {
+      native = jit.compile(*b);
+    }
+    if (native) {
+      intptr_t at = native->run(proc);
+      if (at == JitCode::call) {
+        /***/ DOCALL(); /***/
+      }
+      resume_at = at;
+    }
+  }
+#endif
   // to start, call the closure in stack[0]
-  DISPATCH_BYTECODES {
+  DISPATCH_BYTECODES_AT(resume_at) {
     BYTECODE(accessor): {
       /*check types*/
       Closure* orig =
@@ -719,9 +872,7 @@ ProcessStatus execute(Process& proc, size_t& reductions, Process*& Q, bool init)
       // create continuation
       Closure& kclos = *Closure::NewKClosure(proc, 2); 
       // clos is now invalid
-      // !! should really avoid SymbolsTable::lookup() due to
-      // !! increased lock contention
-      kclos.codereset(proc.global_read(symbols->lookup("<impl>composeo-cont-body")));
+      kclos.codereset(proc.impl_read(impl_composeo_cont_body));
       /*next function*/
       kclos[0] = stack.top(); stack.pop();
       /*continuation*/
@@ -970,9 +1121,7 @@ ProcessStatus execute(Process& proc, size_t& reductions, Process*& Q, bool init)
       stack[0] = Object::to_ref(f);
       // stack[1] already holds current continuation
       Closure *arg = Closure::NewClosure(proc, 1);
-      // !! should really avoid SymbolsTable::lookup() due to
-      // !! increased lock contention
-      arg->codereset(proc.global_read(symbols->lookup("<impl>ccc-fn-body")));
+      arg->codereset(proc.impl_read(impl_ccc_fn_body));
       (*arg)[0] = Object::to_ref(k); // close other current continuation
       stack[2] = Object::to_ref(arg);
       //(f current-continuation function-that-will-call-current-continuation)
@@ -1077,11 +1226,9 @@ ProcessStatus execute(Process& proc, size_t& reductions, Process*& Q, bool init)
         CLOSUREREF;
         size_t saved_params = params - 2;
         stack[0] = clos[2]; // f2
-        // !! should really avoid SymbolsTable::lookup() due to
-        // !! increased lock contention
         Closure & kclos = *Closure::NewKClosure(proc, saved_params + 3);
         // clos is now invalid
-        kclos.codereset(proc.global_read(symbols->lookup("<impl>reducto-cont-body")));
+        kclos.codereset(proc.impl_read(impl_reducto_cont_body));
         kclos[0] = stack[0]; // f2
         kclos[1] = stack[1];
         /*** placeholder ***/
@@ -1126,9 +1273,7 @@ ProcessStatus execute(Process& proc, size_t& reductions, Process*& Q, bool init)
           Closure & nclos = *Closure::NewKClosure(proc,
                                                   // save only necessary
                                                   clos.size() - NN + 3);
-          // !! should really avoid SymbolsTable::lookup() due to
-          // !! increased lock contention
-          nclos.codereset(proc.global_read(symbols->lookup("<impl>reducto-cont-body")));
+          nclos.codereset(proc.impl_read(impl_reducto_cont_body));
           // clos is now invalid
           {CLOSUREREF; //revalidate
             nclos[0] = clos[0];
@@ -1248,7 +1393,6 @@ ProcessStatus execute(Process& proc, size_t& reductions, Process*& Q, bool init)
     // !! continuation, since it expects current continuation in
     // !! stack[1], not in stack[0]
     BYTECODE(spawn): {
-      AllWorkers &w = AllWorkers::getInstance();
       // create new process 
       HlPid *spawned = proc.spawn(stack.top()); stack.pop();
       // release cpu as soon as possible
@@ -1256,9 +1400,8 @@ ProcessStatus execute(Process& proc, size_t& reductions, Process*& Q, bool init)
       stack.push(stack[1]); // current cont.
       stack.push(Object::to_ref(spawned)); // the pid
       stack.restack(2);
-      // process is ready to run, register it to working queue
-      w.register_process(spawned->process);
-      // w.workqueue_push(spawned->process);
+      // process is ready to run; the worker registers it into its
+      // own shard when it switches to it
       Q = spawned->process; // next to run
       return process_change;
     } NEXT_BYTECODE;
@@ -1379,30 +1522,23 @@ ProcessStatus execute(Process& proc, size_t& reductions, Process*& Q, bool init)
       // register args
     } NEXT_BYTECODE;
     BYTECODE(do_executor): {
-      SYMPARAM(s);
-      Executor *e = Executor::findExecutor(s);
-      if (e) {
-        // ?? could this cause problems if an hl function is called
-        // ?? by the Executor?
-        // !! Not if the Executor sets up the hl stack properly for
-        // !! a function call.  In such a case the Executor would
-        // !! really be written in CPS, with an Executor before the
-        // !! hl-function-call setting up the call to the function,
-        // !! creating a continuation structure that will be used
-        // !! by the next Executor, which receives the return value
-        // !! of the hl function call.
-        // !! It does require access to the Process's Heap in order
-        // !! to allocate though
-        // !! Almost definitely we don't want the Executor to call
-        // !! the hl function by calling back into execute().
-        if (e->run(proc, reductions))
-          DOCALL();
-      }
-      else {
-        std::string err("couldn't find executor: ");
-        err += s->getPrintName();
-        throw_HlError(err.c_str());
-      }
+      // the assembler has already looked the executor up
+      Executor *e = (Executor*) pc->val;
+      // ?? could this cause problems if an hl function is called
+      // ?? by the Executor?
+      // !! Not if the Executor sets up the hl stack properly for
+      // !! a function call.  In such a case the Executor would
+      // !! really be written in CPS, with an Executor before the
+      // !! hl-function-call setting up the call to the function,
+      // !! creating a continuation structure that will be used
+      // !! by the next Executor, which receives the return value
+      // !! of the hl function call.
+      // !! It does require access to the Process's Heap in order
+      // !! to allocate though
+      // !! Almost definitely we don't want the Executor to call
+      // !! the hl function by calling back into execute().
+      if (e->run(proc, reductions))
+        DOCALL();
     } NEXT_BYTECODE;
     BYTECODE(iplus): {
       /*currently, integer maths don't actually
@@ -1441,6 +1577,77 @@ ProcessStatus execute(Process& proc, size_t& reductions, Process*& Q, bool init)
     BYTECODE(fless): {
       bytecode_fless(proc, stack);
     } NEXT_BYTECODE;
+    /*fused bytecodes.  Each one stands for a run of
+      bytecodes starting at pc, reads the arguments of
+      the run from pc[0], pc[1]..., then leaves pc at
+      the last bytecode of the run.
+    */
+    BYTECODE(check_vars_local): {
+      bytecode_check_vars(stack, pc[0].val);
+      bytecode_local(stack, pc[1].val);
+      pc += 1;
+    } NEXT_BYTECODE;
+    BYTECODE(global_local): {
+      SYMPARAM(S);
+      bytecode_global(proc, stack, S);
+      bytecode_local(stack, pc[1].val);
+      pc += 1;
+    } NEXT_BYTECODE;
+    BYTECODE(global_local_apply): {
+      SYMPARAM(S);
+      bytecode_global(proc, stack, S);
+      bytecode_local(stack, pc[1].val);
+      stack.restack(pc[2].val);
+      /***/ DOCALL(); /***/
+    } NEXT_BYTECODE;
+    BYTECODE(local_local): {
+      bytecode_local(stack, pc[0].val);
+      bytecode_local(stack, pc[1].val);
+      pc += 1;
+    } NEXT_BYTECODE;
+    BYTECODE(local_apply): {
+      bytecode_local(stack, pc[0].val);
+      stack.restack(pc[1].val);
+      /***/ DOCALL(); /***/
+    } NEXT_BYTECODE;
+    BYTECODE(local_local_iplus): {
+      bytecode_local(stack, pc[0].val);
+      bytecode_local(stack, pc[1].val);
+      bytecode_iplus(proc, stack);
+      pc += 2;
+    } NEXT_BYTECODE;
+    BYTECODE(local_int_iplus): {
+      bytecode_local(stack, pc[0].val);
+      bytecode_int(proc, stack, pc[1].val);
+      bytecode_iplus(proc, stack);
+      pc += 2;
+    } NEXT_BYTECODE;
+    BYTECODE(local_int_iminus): {
+      bytecode_local(stack, pc[0].val);
+      bytecode_int(proc, stack, pc[1].val);
+      bytecode_iminus(proc, stack);
+      pc += 2;
+    } NEXT_BYTECODE;
+    BYTECODE(int_local_iless_jmp_nil): {
+      bytecode_int(proc, stack, pc[0].val);
+      bytecode_local(stack, pc[1].val);
+      bytecode_iless(proc, stack);
+      pc += 3;
+      Object::ref gp = stack.top(); stack.pop();
+      if (gp==Object::nil()) {
+        pc += pc->val;
+      }
+    } NEXT_BYTECODE;
+    BYTECODE(local_int_iless_jmp_nil): {
+      bytecode_local(stack, pc[0].val);
+      bytecode_int(proc, stack, pc[1].val);
+      bytecode_iless(proc, stack);
+      pc += 3;
+      Object::ref gp = stack.top(); stack.pop();
+      if (gp==Object::nil()) {
+        pc += pc->val;
+      }
+    } NEXT_BYTECODE;
   }
   // execution shouldn't reach this point
   throw_HlError("internal: end of execute() reached");
@@ -28,6 +28,7 @@ Symbol* symbol_binobj;
 Symbol* symbol_io;
 Symbol* symbol_bool;
 Symbol* symbol_call_star;
+Symbol* symbol_impl_body[impl_body_count];
 
 #include"symbols.hpp"
 
@@ -62,6 +63,12 @@ void initialize_globals(void) {
 	symbol_io = symbols->lookup("<hl>i/o");
         symbol_bool = symbols->lookup("<hl>bool");
         symbol_call_star = symbols->lookup("<hl>call*");
+	symbol_impl_body[impl_reducto_cont_body] =
+		symbols->lookup("<impl>reducto-cont-body");
+	symbol_impl_body[impl_ccc_fn_body] =
+		symbols->lookup("<impl>ccc-fn-body");
+	symbol_impl_body[impl_composeo_cont_body] =
+		symbols->lookup("<impl>composeo-cont-body");
 
 	aio_initialize();
 
@@ -2,10 +2,13 @@
 #include"objects.hpp"
 #include"heaps.hpp"
 #include"types.hpp"
+#include"executors.hpp"
 
 #include<map>
+#include<set>
 #include<stack>
 #include<cstdlib>
+#include<iostream>
 #include<stdint.h>
 
 /*-----------------------------------------------------------------------------
@@ -152,21 +155,31 @@ void Semispace::traverse_objects(HeapTraverser* ht) const {
 	}
 }
 
+void Semispace::traverse_pids(HeapTraverser* ht) const {
+	for(size_t i = 0; i < pids.size(); ++i) {
+		ht->traverse(pids[i]);
+	}
+}
+
 /*Used by SemispaceCloningTraverser below*/
 class MovingTraverser : public GenericTraverser {
 private:
+	Semispace const* from;
 	ptrdiff_t diff;
 public:
 	void traverse(Object::ref& o) {
 		if(is_a<Generic*>(o)) {
 			Generic* gp = as_a<Generic*>(o);
+			/*leave references to the code space alone*/
+			if(!from->contains(gp)) return;
 			char* cgp = (char*)(void*) gp;
 			cgp -= diff;
 			gp = (Generic*)(void*) cgp;
 			o = Object::to_ref(gp);
 		}
 	}
-	explicit MovingTraverser(ptrdiff_t ndiff) : diff(ndiff) { }
+	MovingTraverser(Semispace const* nfrom, ptrdiff_t ndiff)
+		: from(nfrom), diff(ndiff) { }
 };
 
 class SemispaceCloningTraverser : public HeapTraverser {
@@ -178,14 +191,15 @@ public:
 		Generic* np = gp->clone(sp);
 		np->traverse_references(&mt);
 	}
-	SemispaceCloningTraverser(Semispace* nsp, ptrdiff_t ndiff)
-		: sp(nsp), mt(ndiff) { }
+	SemispaceCloningTraverser(Semispace* nsp, Semispace const* from,
+			ptrdiff_t ndiff)
+		: sp(nsp), mt(from, ndiff) { }
 };
 
 /*Preconditions:
 	this should be self-contained (i.e. objects in it
 	  should not contain references to objects outside
-	  of this semispace)
+	  of this semispace, other than to the code space)
 	this should have no lifo-allocated objects
 */
 void Semispace::clone(boost::scoped_ptr<Semispace>& ns, Generic*& g) const {
@@ -193,10 +207,11 @@ void Semispace::clone(boost::scoped_ptr<Semispace>& ns, Generic*& g) const {
 	char* myallocstart = (char*) allocstart;
 	char* hisallocstart = (char*) ns->allocstart;
 
-	SemispaceCloningTraverser sct(&*ns, myallocstart - hisallocstart);
+	SemispaceCloningTraverser sct(&*ns, this, myallocstart - hisallocstart);
 
 	traverse_objects(&sct);
 
+	if(!contains(g)) return;
 	char* cg = (char*)(void*) g;
 	cg -= (myallocstart - hisallocstart);
 	g = (Generic*)(void*) cg;
@@ -212,6 +227,12 @@ void ValueHolder::traverse_objects(HeapTraverser* ht) const {
 	}
 }
 
+void ValueHolder::traverse_pids(HeapTraverser* ht) const {
+	for(ValueHolder const* pt = this; pt; pt = &*pt->next) {
+		if(pt->sp) pt->sp->traverse_pids(ht);
+	}
+}
+
 /*clones only itself, not the chain*/
 void ValueHolder::clone(ValueHolderRef& np) const {
 	np.p = new ValueHolder();
@@ -230,14 +251,22 @@ class ObjectMeasurer : public GenericTraverser {
 public:
 	size_t N;
 	std::map<Generic*,Generic*>* mp;
+	/*objects that have been moved to the code space*/
+	std::map<Generic*,Generic*> const* shared;
 	std::stack<Generic*> todo;
 
-	explicit ObjectMeasurer(std::map<Generic*,Generic*>* nmp)
-		: N(0), mp(nmp) { }
+	ObjectMeasurer(std::map<Generic*,Generic*>* nmp,
+			std::map<Generic*,Generic*> const* nshared)
+		: N(0), mp(nmp), shared(nshared) { }
 
+	bool skip(Generic* gp) const {
+		return code_space.contains(gp) ||
+			shared->find(gp) != shared->end();
+	}
 	void traverse(Object::ref& o) {
 		if(is_a<Generic*>(o)) {
 			Generic* gp = as_a<Generic*>(o);
+			if(skip(gp)) return;
 			if(mp->find(gp) == mp->end()) {
 				(*mp)[gp] = gp;
 				todo.push(gp);
@@ -245,6 +274,7 @@ public:
 		}
 	}
 	void operate(Generic* gp) {
+		if(skip(gp)) return;
 		(*mp)[gp] = gp;
 		todo.push(gp);
 		do {
@@ -272,30 +302,38 @@ public:
 	}
 };
 
-void ValueHolder::copy_object(ValueHolderRef& np, Object::ref o) {
+void ValueHolder::copy_object(ValueHolderRef& np, Object::ref o,
+		bool share_code) {
 	typedef std::map<Generic*, Generic*> TM;
 	if(is_a<Generic*>(o)) {
+		Generic* old_o = as_a<Generic*>(o);
+		TM shared;
+		if(share_code) code_space.share(old_o, shared);
 		TM obs;
 		size_t total = 0;
 		/*first, measure the memory*/
-		{ObjectMeasurer om(&obs);
-			om.operate(as_a<Generic*>(o));
+		{ObjectMeasurer om(&obs, &shared);
+			om.operate(old_o);
 			total = om.N;
 		}
-		/*now create the Semispace*/
-		boost::scoped_ptr<Semispace> sp(new Semispace(total));
+		/*now create the Semispace, unless everything is in
+		the code space
+		*/
+		boost::scoped_ptr<Semispace> sp;
+		if(!obs.empty()) sp.reset(new Semispace(total));
 
 		/*copy*/
 		for(TM::iterator it = obs.begin(); it != obs.end(); ++it) {
 			it->second = it->second->clone(&*sp);
 		}
+		obs.insert(shared.begin(), shared.end());
 
 		/*translate*/
-		{ObjectsTraverser<ReferenceReplacer> ot(&obs);
+		if(sp) {ObjectsTraverser<ReferenceReplacer> ot(&obs);
 			sp->traverse_objects(&ot);
 		}
-		Generic* old_o = as_a<Generic*>(o);
-		Generic* new_o = obs[old_o];
+		TM::iterator it = obs.find(old_o);
+		Generic* new_o = it != obs.end() ? it->second : old_o;
 		o = Object::to_ref(new_o);
 
 		/*create holder*/
@@ -308,6 +346,121 @@ void ValueHolder::copy_object(ValueHolderRef& np, Object::ref o) {
 	}
 }
 
+/*-----------------------------------------------------------------------------
+Code space
+-----------------------------------------------------------------------------*/
+
+CodeSpace code_space;
+
+void CodeSpace::reset(size_t sz) {
+	sp.reset();
+	lo = hi = 0;
+	unshared_bodies = 0;
+	if(sz == 0) return;
+	sp.reset(new Semispace(sz));
+	lo = (char const*) sp->mem;
+	hi = lo + sp->max;
+}
+
+size_t CodeSpace::used(void) {
+	AppLock l(m);
+	return sp ? sp->used() : 0;
+}
+
+size_t CodeSpace::unshared(void) {
+	AppLock l(m);
+	return unshared_bodies;
+}
+
+/*a body, or a number in one; none of them can be changed*/
+static bool immutable(Generic* gp) {
+	return dynamic_cast<Bytecode*>(gp) || dynamic_cast<Float*>(gp) ||
+		dynamic_cast<BigInt*>(gp);
+}
+
+class ChildrenCollector : public GenericTraverser {
+public:
+	std::vector<Generic*> children;
+	void traverse(Object::ref& o) {
+		if(is_a<Generic*>(o)) children.push_back(as_a<Generic*>(o));
+	}
+};
+
+void CodeSpace::share(Generic* root, std::map<Generic*, Generic*>& moved) {
+	typedef std::map<Generic*, Generic*> TM;
+	AppLock l(m);
+	if(!sp) return;
+	std::set<Generic*> seen;
+	std::stack<Generic*> todo;
+	seen.insert(root);
+	todo.push(root);
+	while(!todo.empty()) {
+		Generic* gp = todo.top(); todo.pop();
+		if(contains(gp) || moved.find(gp) != moved.end()) continue;
+		if(dynamic_cast<Bytecode*>(gp)) {
+			/*gather the body and everything it refers to,
+			unless it refers to something mutable
+			*/
+			std::vector<Generic*> obs;
+			std::set<Generic*> in;
+			std::stack<Generic*> body;
+			size_t total = 0;
+			bool ok = true;
+			in.insert(gp);
+			body.push(gp);
+			while(ok && !body.empty()) {
+				Generic* bp = body.top(); body.pop();
+				if(!immutable(bp)) {
+					ok = false;
+					break;
+				}
+				obs.push_back(bp);
+				total += bp->real_size();
+				ChildrenCollector cc;
+				bp->traverse_references(&cc);
+				for(size_t i = 0; i < cc.children.size(); ++i) {
+					Generic* c = cc.children[i];
+					if(contains(c) || moved.find(c) != moved.end()) {
+						continue;
+					}
+					if(in.insert(c).second) body.push(c);
+				}
+			}
+			if(ok && !sp->can_fit(total)) {
+				if(unshared_bodies++ == 0) {
+					std::cerr << "Warning: the code space is full "
+						"(" << sp->used() << " bytes used); "
+						"bodies of globals set from now on are "
+						"copied into each process that reads "
+						"them.  See --code-space."
+						<< std::endl;
+				}
+			} else if(ok) {
+				TM local;
+				for(size_t i = 0; i < obs.size(); ++i) {
+					local[obs[i]] = obs[i]->clone(&*sp);
+				}
+				ReferenceReplacer rl(&local);
+				ReferenceReplacer rm(&moved);
+				for(TM::iterator it = local.begin(); it != local.end(); ++it) {
+					it->second->traverse_references(&rl);
+					it->second->traverse_references(&rm);
+				}
+				moved.insert(local.begin(), local.end());
+				continue;
+			}
+			/*can't move it, but maybe the bodies in it*/
+		}
+		ChildrenCollector cc;
+		gp->traverse_references(&cc);
+		for(size_t i = 0; i < cc.children.size(); ++i) {
+			if(seen.insert(cc.children[i]).second) {
+				todo.push(cc.children[i]);
+			}
+		}
+	}
+}
+
 /*-----------------------------------------------------------------------------
 Heaps
 -----------------------------------------------------------------------------*/
@@ -322,6 +475,15 @@ void Heap::traverse_objects(HeapTraverser* ht) const {
 	}
 }
 
+void Heap::traverse_pids(HeapTraverser* ht) const {
+	if(main) {
+		main->traverse_pids(ht);
+	}
+	if(!other_spaces.empty()) {
+		other_spaces->traverse_pids(ht);
+	}
+}
+
 /*copy and modify GC class*/
 class GCTraverser : public GenericTraverser {
 	Semispace* nsp;
@@ -330,6 +492,7 @@ public:
 	void traverse(Object::ref& r) {
 		if(is_a<Generic*>(r)) {
 			Generic* gp = as_a<Generic*>(r);
+			if(code_space.contains(gp)) return;
 			BrokenHeart* bp = dynamic_cast<BrokenHeart*>(gp);
 			if(bp) { //broken heart
 				r = Object::to_ref(bp->to);
@@ -364,12 +527,26 @@ void Heap::cheney_collection(Semispace* nsp) {
 	#include<iostream>
 #endif
 
+/*sets Heap::collecting for the duration of a GC, even if
+allocating the new semispace throws
+*/
+class CollectingFlag {
+private:
+	volatile sig_atomic_t& flag;
+public:
+	explicit CollectingFlag(volatile sig_atomic_t& nflag)
+		: flag(nflag) { flag = 1; }
+	~CollectingFlag() { flag = 0; }
+};
+
 void Heap::GC(size_t insurance) {
 
 	#ifdef DEBUG
 		std::cout << "GC!" << std::endl;
 	#endif
 
+	CollectingFlag cf(collecting);
+
 	/*Determine the sizes of all semispaces*/
 	size_t total = main->used() + insurance;
 	total +=
@@ -5,73 +5,116 @@
 #include "reader.hpp"
 #include "types.hpp"
 
+History::Mode History::mode = History::history_full;
+size_t History::sample_period = 64;
+
+History::Ring::Ring(void) : newest(breadth - 1), used(0), countdown(0) {
+	for(size_t i = 0; i < breadth; ++i) {
+		entries[i].owner = Object::nil();
+		entries[i].fn = Object::nil();
+		entries[i].nargs = 0;
+	}
+}
+
+void History::Ring::record(ProcessStack& stack) {
+	newest = (newest + 1) % breadth;
+	Entry& e = entries[newest];
+	if(e.owner == Object::nil()) ++used;
+	e.owner = stack[1];
+	e.fn = stack[0];
+	/*skip stack[1] in the debug dump*/
+	e.nargs = stack.size() - 2;
+	size_t n = e.nargs < max_args ? e.nargs : max_args;
+	for(size_t i = 0; i < n; ++i) {
+		e.args[i] = stack[i + 2];
+	}
+}
+
+void History::Ring::traverse_references(GenericTraverser* gt) {
+	if(used == 0) return;
+	for(size_t i = 0; i < breadth; ++i) {
+		Entry& e = entries[i];
+		if(e.owner == Object::nil()) continue;
+		gt->traverse(e.owner);
+		gt->traverse(e.fn);
+		size_t n = e.nargs < max_args ? e.nargs : max_args;
+		for(size_t j = 0; j < n; ++j) {
+			gt->traverse(e.args[j]);
+		}
+	}
+}
+
 void History::entry(void) {
-	if(known_type<Closure>(stack[0])->kontinuation) {
+	if(known_type<Closure>(stack[0])->continuation) {
 		/*called a continuation: remove tail calls using this continuation*/
-		known_type<Closure>(stack[0])->kontinuation->clear();
+		if(ring) ring->forget(stack[0]);
 	} else {
 		/*called an ordinary function: add to tail calls on current continuation*/
+		if(mode == history_off) return;
 		if(stack.size() < 2) return;
 
-		Closure* pkclos = maybe_type<Closure>(stack[1]);
+		Closure* pkclos = maybe_exact_type<Closure>(stack[1]);
 		if(!pkclos) return;
+		if(!pkclos->continuation) return;
 
-		Closure& kclos = *pkclos;
-		if(!kclos.kontinuation) return;
-
-		InnerRing& inner_ring = *kclos.kontinuation;
-		// ?? for some reason, after insertion capacity must be set again
-		inner_ring.repeat_set_capacity();
-		inner_ring.push_front(Item());
-
-		Item& it = inner_ring.front();
-		it.resize(stack.size() - 1, Object::nil());
-		it[0] = stack[0];
-		/*skip stack[1] in the debug dump*/
-		for(size_t i = 1; i < (stack.size() - 1); ++i) {
-			it[i] = stack[i + 1];
+		if(!ring) ring.reset(new Ring());
+		if(mode == history_sampled) {
+			if(ring->countdown != 0) {
+				--ring->countdown;
+				return;
+			}
+			ring->countdown = sample_period ? sample_period - 1 : 0;
 		}
+		ring->record(stack);
 	}
 }
 
 // returned list is of type
 // ((functon arg1 ... argn) ...)
+// arguments beyond Ring::max_args are not shown
 void History::to_list(Process & proc) {
-	ProcessStack & s = proc.stack;
 	size_t count = 0; // number of elements in the history
+	// entries not yet found on the chain
+	size_t left = ring ? ring->used : 0;
 	Closure* pkclos;
 	pkclos = maybe_type<Closure>(stack[1]);
-	if(pkclos && pkclos->kontinuation) goto outer_loop;
+	if(pkclos && pkclos->continuation) goto outer_loop;
 	pkclos = maybe_type<Closure>(stack[0]);
-	if(pkclos && pkclos->kontinuation) goto outer_loop;
+	if(pkclos && pkclos->continuation) goto outer_loop;
 	goto end_outer_loop;
 outer_loop:
-	/*go through the kontinuation*/
-	{ InnerRing& ring = *pkclos->kontinuation;
-		for(InnerRing::iterator it = ring.begin();
-				it != ring.end();
-				++it) {
-			Item& item = *it;
-			{ size_t count = 0;
-				for(Item::iterator it = item.begin();
-						it != item.end();
-						++it) {
-					proc.stack.push(*it);
-					++count;
-				}
-				proc.stack.push(Object::nil());
-				for(; count; --count) {
-					bytecode_cons(proc, stack);
-				}
+	if(left == 0) goto end_outer_loop;
+	/*go through the entries made under this continuation,
+	newest first
+	*/
+	{ Object::ref k = Object::to_ref<Generic*>(pkclos);
+		for(size_t j = 0; j < Ring::breadth; ++j) {
+			size_t i = (ring->newest + Ring::breadth - j) % Ring::breadth;
+			/*re-read each time: consing may trigger a GC*/
+			Ring::Entry& e = ring->entries[i];
+			if(e.owner != k) continue;
+			size_t n = e.nargs < Ring::max_args ?
+				e.nargs : Ring::max_args;
+			proc.stack.push(e.fn);
+			for(size_t a = 0; a < n; ++a) {
+				proc.stack.push(ring->entries[i].args[a]);
+			}
+			proc.stack.push(Object::nil());
+			for(size_t c = n + 1; c; --c) {
+				bytecode_cons(proc, stack);
 			}
+			/*the continuation may have moved*/
+			k = ring->entries[i].owner;
 			++count;
+			--left;
 		}
+		pkclos = known_type<Closure>(k);
 	}
 	/*search for a parent continuation*/
 	for(size_t i = 0; i < pkclos->size(); ++i) {
 		Closure* npkclos = maybe_type<Closure>((*pkclos)[i]);
 		if(npkclos) {
-			if(npkclos->kontinuation) {
+			if(npkclos->continuation) {
 				pkclos = npkclos;
 				goto outer_loop;
 			}
@@ -84,12 +127,3 @@ end_outer_loop:
 		bytecode_cons(proc, proc.stack);
 	}
 }
-
-void History::InnerRing::traverse_references(GenericTraverser* gt) {
-	for(iterator it = begin(); it != end(); ++it) {
-		for(Item::iterator vit = it->begin(); vit != it->end(); ++vit) {
-			gt->traverse(*vit);
-		}
-	}
-}
-
@@ -0,0 +1,445 @@
+#include"all_defines.hpp"
+
+#include"jit.hpp"
+
+#ifdef HAVE_JIT
+
+#include"types.hpp"
+#include"bytecodes.hpp"
+#include"assembler.hpp"
+
+#include<vector>
+#include<cstring>
+
+#include<unistd.h>
+#include<sys/mman.h>
+
+Jit jit;
+
+size_t Jit::threshold = 100;
+
+/*-----------------------------------------------------------------------------
+JitCode
+-----------------------------------------------------------------------------*/
+
+JitCode::JitCode(void* nmem, size_t nmem_size, size_t ndepth)
+	: mem(nmem), mem_size(nmem_size),
+	  entry(reinterpret_cast<entry_fn>(nmem)), depth(ndepth) { }
+
+JitCode::~JitCode() {
+	munmap(mem, mem_size);
+}
+
+/*-----------------------------------------------------------------------------
+Bytecode
+-----------------------------------------------------------------------------*/
+
+static AppMutex native_m;
+
+JitCode* Bytecode::setNative(boost::shared_ptr<JitCode> const& n) {
+	AppLock l(native_m);
+	if(!native) {
+		native = n;
+		/*the native code is complete before it is published*/
+		__asm__ __volatile__ ("" ::: "memory");
+		native_code = n.get();
+	}
+	return native_code;
+}
+
+/*-----------------------------------------------------------------------------
+x86-64 machine code
+-----------------------------------------------------------------------------*/
+
+namespace {
+
+enum Reg {
+	rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+	r8, r9, r10, r11, r12, r13, r14, r15
+};
+
+/*condition codes, for jcc and cmov*/
+enum Cond {
+	cond_o = 0x0,
+	cond_z = 0x4,
+	cond_nz = 0x5,
+	cond_l = 0xC
+};
+
+/*the /digit of the group-1 immediate and shift opcodes*/
+enum {
+	ext_add = 0, ext_or = 1, ext_and = 4, ext_sub = 5, ext_cmp = 7,
+	ext_shl = 4, ext_sar = 7
+};
+
+/*register-register opcodes*/
+enum {
+	op_add = 0x01, op_sub = 0x29, op_cmp = 0x39
+};
+
+class CodeBuffer {
+private:
+	std::vector<unsigned char> b;
+	/*offset of each label, or -1 if not yet bound*/
+	std::vector<ptrdiff_t> labels;
+	/*rel32 fields to patch: offset of the field, label*/
+	std::vector<std::pair<size_t, size_t> > fixups;
+
+	void byte(unsigned int x) { b.push_back(x & 0xFF); }
+	void dword(uint32_t x) {
+		for(size_t i = 0; i < 4; ++i) byte(x >> (8 * i));
+	}
+	void qword(uint64_t x) {
+		for(size_t i = 0; i < 8; ++i) byte(x >> (8 * i));
+	}
+	static bool is_int8(intptr_t x) { return x >= -128 && x <= 127; }
+	static bool is_int32(intptr_t x) {
+		return x >= -2147483647 - 1 && x <= 2147483647;
+	}
+
+	/*the REX prefix, if any is needed*/
+	void rex(bool w, int reg, int rm) {
+		unsigned int r = 0x40 | (w << 3) | ((reg & 8) >> 1) | ((rm & 8) >> 3);
+		if(r != 0x40) byte(r);
+	}
+	void modrm_reg(int reg, int rm) {
+		byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+	}
+	/*[base + disp]*/
+	void modrm_mem(int reg, int base, int32_t disp) {
+		bool d8 = is_int8(disp);
+		byte((d8 ? 0x40 : 0x80) | ((reg & 7) << 3) | (base & 7));
+		if((base & 7) == rsp) byte(0x24); // SIB: no index
+		if(d8) byte(disp); else dword(disp);
+	}
+	void rel32(size_t label) {
+		fixups.push_back(std::make_pair(b.size(), label));
+		dword(0);
+	}
+
+public:
+	size_t size(void) const { return b.size(); }
+	unsigned char const* data(void) const { return &b[0]; }
+
+	size_t new_label(void) {
+		labels.push_back(-1);
+		return labels.size() - 1;
+	}
+	void bind(size_t label) { labels[label] = b.size(); }
+	/*patch all jumps; all labels jumped to must be bound*/
+	void link(void) {
+		for(size_t i = 0; i < fixups.size(); ++i) {
+			size_t at = fixups[i].first;
+			int32_t rel = labels[fixups[i].second] - (ptrdiff_t) (at + 4);
+			for(size_t j = 0; j < 4; ++j) b[at + j] = (rel >> (8 * j)) & 0xFF;
+		}
+	}
+
+	/*mov reg, [base + disp]*/
+	void load(int reg, int base, int32_t disp) {
+		rex(1, reg, base); byte(0x8B); modrm_mem(reg, base, disp);
+	}
+	/*mov [base + disp], reg*/
+	void store(int base, int32_t disp, int reg) {
+		rex(1, reg, base); byte(0x89); modrm_mem(reg, base, disp);
+	}
+	/*lea reg, [base + disp]*/
+	void lea(int reg, int base, int32_t disp) {
+		rex(1, reg, base); byte(0x8D); modrm_mem(reg, base, disp);
+	}
+	/*mov dst, src*/
+	void mov(int dst, int src) {
+		rex(1, src, dst); byte(0x89); modrm_reg(src, dst);
+	}
+	/*mov reg, imm; leaves the flags alone*/
+	void mov_imm(int reg, intptr_t v) {
+		if(is_int32(v)) {
+			rex(1, 0, reg); byte(0xC7); modrm_reg(0, reg); dword(v);
+		} else {
+			rex(1, 0, reg); byte(0xB8 + (reg & 7)); qword(v);
+		}
+	}
+	/*add/or/and/sub/cmp reg, imm*/
+	void alu_imm(int ext, int reg, int32_t v) {
+		rex(1, 0, reg);
+		if(is_int8(v)) {
+			byte(0x83); modrm_reg(ext, reg); byte(v);
+		} else {
+			byte(0x81); modrm_reg(ext, reg); dword(v);
+		}
+	}
+	/*add/sub/cmp dst, src; 32-bit unless w*/
+	void alu(int op, bool w, int dst, int src) {
+		rex(w, src, dst); byte(op); modrm_reg(src, dst);
+	}
+	/*shl/sar reg, n*/
+	void shift(int ext, int reg, int n) {
+		rex(1, 0, reg); byte(0xC1); modrm_reg(ext, reg); byte(n);
+	}
+	/*movsxd dst, src32*/
+	void movsxd(int dst, int src) {
+		rex(1, dst, src); byte(0x63); modrm_reg(dst, src);
+	}
+	/*cmovcc dst, src*/
+	void cmov(Cond c, int dst, int src) {
+		rex(1, dst, src); byte(0x0F); byte(0x40 | c); modrm_reg(dst, src);
+	}
+	/*test al, al*/
+	void test_al(void) { byte(0x84); byte(0xC0); }
+	void push(int reg) { rex(0, 0, reg); byte(0x50 + (reg & 7)); }
+	void pop(int reg) { rex(0, 0, reg); byte(0x58 + (reg & 7)); }
+	void call(int reg) { rex(0, 0, reg); byte(0xFF); modrm_reg(2, reg); }
+	void ret(void) { byte(0xC3); }
+	void jcc(Cond c, size_t label) { byte(0x0F); byte(0x80 | c); rel32(label); }
+	void jmp(size_t label) { byte(0xE9); rel32(label); }
+};
+
+/*register assignment in native code; all callee-saved*/
+Reg const TP = rbx;	// ProcessStack::tp
+Reg const BASE = rbp;	// ProcessStack::base
+Reg const STACK = r14;	// ProcessStack*
+Reg const PROC = r15;	// Process*
+
+intptr_t raw(Object::ref x) {
+	intptr_t rv;
+	std::memcpy(&rv, &x, sizeof(rv));
+	return rv;
+}
+
+/*Called from native code, with the ProcessStack up to date.
+They may allocate but never throw: on an error they return 0
+with the stack unchanged, and the interpreter runs the
+bytecode again to report the error.
+*/
+bool helper_global(Process* proc, intptr_t S) {
+	try {
+		bytecode_global(*proc, proc->stack, (Symbol*) S);
+		return 1;
+	} catch(...) {
+		return 0;
+	}
+}
+bool helper_closure_ref(Process* proc, intptr_t N) {
+	ProcessStack& stack = proc->stack;
+	Closure& clos = *known_type<Closure>(stack[0]);
+	if((size_t) N >= clos.size()) return 0;
+	bytecode_closure_ref(stack, clos, N);
+	return 1;
+}
+
+}
+
+/*-----------------------------------------------------------------------------
+Jit
+-----------------------------------------------------------------------------*/
+
+JitTemplate Jit::templateOf(_bytecode_label lbl) {
+	/*a fused bytecode is followed by the rest of its run, so
+	compile it as the first bytecode of the run
+	*/
+	size_t i = assembler.opcode(assembler.original(lbl));
+	return i < templates.size() ? templates[i] : jit_none;
+}
+
+void Jit::reg(_bytecode_label lbl, JitTemplate t) {
+	size_t i = assembler.opcode(lbl);
+	if(i == OpcodeIndex::none) return;
+	if(i >= templates.size()) templates.resize(i + 1, jit_none);
+	templates[i] = t;
+}
+
+/*offset of a ProcessStack field*/
+static int32_t stack_field(Object::ref* ProcessStack::* f) {
+	ProcessStack s;
+	return (char*) &(s.*f) - (char*) &s;
+}
+
+JitCode* Jit::compile(Bytecode& b) {
+	bytecode_t* code = b.getCode();
+	size_t len = b.getLen();
+	if(len == 0 || templateOf(code[0].op) == jit_none) return NULL;
+
+	int32_t const tp_field = stack_field(&ProcessStack::tp);
+	int32_t const base_field = stack_field(&ProcessStack::base);
+	/*largest local/closure index addressed inline*/
+	intptr_t const max_index = 1 << 20;
+
+	CodeBuffer cb;
+	std::vector<size_t> at(len);
+	for(size_t i = 0; i < len; ++i) at[i] = cb.new_label();
+	/*side exits, made on demand*/
+	std::vector<size_t> exits(len, (size_t) -1);
+	#define EXIT(i) \
+		(exits[i] == (size_t) -1 ? (exits[i] = cb.new_label()) : exits[i])
+	size_t epilogue = cb.new_label();
+	size_t depth = 0;
+
+	cb.push(rbx); cb.push(rbp); cb.push(r14); cb.push(r15);
+	cb.alu_imm(ext_sub, rsp, 8); // keep rsp 16-byte aligned for calls
+	cb.mov(STACK, rdi);
+	cb.mov(PROC, rsi);
+	cb.load(TP, STACK, tp_field);
+	cb.load(BASE, STACK, base_field);
+
+	for(size_t i = 0; i < len; ++i) {
+		cb.bind(at[i]);
+		intptr_t N = code[i].val;
+		JitTemplate t = templateOf(code[i].op);
+		switch(t) {
+		case jit_local:
+		case jit_closure_ref:
+		case jit_check_vars:
+		case jit_apply:
+		case jit_continue_local:
+			if(N < 0 || N > max_index) t = jit_none;
+			break;
+		case jit_jmp_nil:
+			if(N < 0 || i + 1 + N >= len) t = jit_none;
+			break;
+		default:
+			break;
+		}
+		switch(t) {
+		case jit_none:
+			/*the interpreter takes over*/
+			cb.mov_imm(rax, i);
+			cb.jmp(epilogue);
+			break;
+		case jit_check_vars:
+			cb.mov(rax, TP);
+			cb.alu(op_sub, 1, rax, BASE);
+			cb.alu_imm(ext_cmp, rax, N * sizeof(Object::ref));
+			cb.jcc(cond_nz, EXIT(i));
+			break;
+		case jit_local:
+			cb.load(rax, BASE, N * sizeof(Object::ref));
+			cb.store(TP, 0, rax);
+			cb.alu_imm(ext_add, TP, sizeof(Object::ref));
+			++depth;
+			break;
+		case jit_int:
+		case jit_lit_nil:
+		case jit_lit_t:
+			cb.mov_imm(rax, raw(
+				(t == jit_int) ?	Object::to_ref((int) N) :
+				(t == jit_lit_t) ?	Object::t() :
+				/*otherwise*/		Object::nil() ));
+			cb.store(TP, 0, rax);
+			cb.alu_imm(ext_add, TP, sizeof(Object::ref));
+			++depth;
+			break;
+		case jit_iplus:
+		case jit_iminus:
+		case jit_iless:
+			cb.load(rax, TP, -2 * (int32_t) sizeof(Object::ref));
+			cb.load(rcx, TP, -1 * (int32_t) sizeof(Object::ref));
+			/*both must be smallints*/
+			cb.mov(rdx, rax);
+			cb.alu_imm(ext_and, rdx, Object::tag_mask);
+			cb.alu_imm(ext_cmp, rdx, raw(Object::to_ref(0)));
+			cb.jcc(cond_nz, EXIT(i));
+			cb.mov(rdx, rcx);
+			cb.alu_imm(ext_and, rdx, Object::tag_mask);
+			cb.alu_imm(ext_cmp, rdx, raw(Object::to_ref(0)));
+			cb.jcc(cond_nz, EXIT(i));
+			cb.shift(ext_sar, rax, Object::tag_bits);
+			cb.shift(ext_sar, rcx, Object::tag_bits);
+			if(t == jit_iless) {
+				cb.mov_imm(rdx, raw(Object::t()));
+				cb.alu(op_cmp, 0, rax, rcx);
+				cb.mov_imm(rax, raw(Object::nil()));
+				cb.cmov(cond_l, rax, rdx);
+			} else {
+				/*int arithmetic; let the interpreter
+				decide what an overflow means
+				*/
+				cb.alu(t == jit_iplus ? op_add : op_sub, 0, rax, rcx);
+				cb.jcc(cond_o, EXIT(i));
+				cb.movsxd(rax, rax);
+				cb.shift(ext_shl, rax, Object::tag_bits);
+				cb.alu_imm(ext_or, rax, raw(Object::to_ref(0)));
+			}
+			cb.store(TP, -2 * (int32_t) sizeof(Object::ref), rax);
+			cb.alu_imm(ext_sub, TP, sizeof(Object::ref));
+			break;
+		case jit_jmp_nil:
+			cb.alu_imm(ext_sub, TP, sizeof(Object::ref));
+			cb.load(rax, TP, 0);
+			cb.mov_imm(rdx, raw(Object::nil()));
+			cb.alu(op_cmp, 1, rax, rdx);
+			cb.jcc(cond_z, at[i + 1 + N]);
+			break;
+		case jit_global:
+		case jit_closure_ref:
+			cb.store(STACK, tp_field, TP);
+			cb.mov(rdi, PROC);
+			cb.mov_imm(rsi, N);
+			cb.mov_imm(rax, (intptr_t) (t == jit_global ?
+				&helper_global : &helper_closure_ref));
+			cb.call(rax);
+			cb.load(TP, STACK, tp_field);
+			cb.load(BASE, STACK, base_field);
+			cb.test_al();
+			cb.jcc(cond_z, EXIT(i));
+			++depth;
+			break;
+		case jit_apply:
+			cb.lea(BASE, TP, -N * (int32_t) sizeof(Object::ref));
+			cb.mov_imm(rax, JitCode::call);
+			cb.jmp(epilogue);
+			break;
+		case jit_continue_local:
+			cb.load(rax, BASE, N * sizeof(Object::ref));
+			cb.store(TP, 0, rax);
+			cb.alu_imm(ext_add, TP, sizeof(Object::ref));
+			++depth;
+			/*fall through*/
+		case jit_continue:
+			/*the continuation and the value on the top
+			become the frame
+			*/
+			cb.load(rax, BASE, sizeof(Object::ref));
+			cb.store(TP, -2 * (int32_t) sizeof(Object::ref), rax);
+			cb.lea(BASE, TP, -2 * (int32_t) sizeof(Object::ref));
+			cb.mov_imm(rax, JitCode::call);
+			cb.jmp(epilogue);
+			break;
+		}
+	}
+	/*every body ends in a call or a bytecode that has no
+	template, so control never gets here
+	*/
+	cb.mov_imm(rax, len);
+
+	cb.bind(epilogue);
+	cb.store(STACK, tp_field, TP);
+	cb.store(STACK, base_field, BASE);
+	cb.alu_imm(ext_add, rsp, 8);
+	cb.pop(r15); cb.pop(r14); cb.pop(rbp); cb.pop(rbx);
+	cb.ret();
+
+	for(size_t i = 0; i < len; ++i) {
+		if(exits[i] == (size_t) -1) continue;
+		cb.bind(exits[i]);
+		cb.mov_imm(rax, i);
+		cb.jmp(epilogue);
+	}
+	#undef EXIT
+	cb.link();
+
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t sz = (cb.size() + page - 1) / page * page;
+	void* mem = mmap(NULL, sz, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(mem == MAP_FAILED) return NULL;
+	std::memcpy(mem, cb.data(), cb.size());
+	if(mprotect(mem, sz, PROT_READ | PROT_EXEC) != 0) {
+		munmap(mem, sz);
+		return NULL;
+	}
+	JitCode* rv = new JitCode(mem, sz, depth);
+	return b.setNative(boost::shared_ptr<JitCode>(rv));
+}
+
+#endif // HAVE_JIT
+
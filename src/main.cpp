@@ -5,17 +5,25 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <cstdlib>
 
+#include <boost/scoped_array.hpp>
+
 #include "reader.hpp"
 #include "executors.hpp"
 #include "assembler.hpp"
+#include "asmcache.hpp"
 #include "symbols.hpp"
 #include "types.hpp"
 #include "workers.hpp"
 #include "assembler.hpp"
 #include "mutexes.hpp"
 #include "read_directory.hpp"
+#include "jit.hpp"
+#include "samples.hpp"
+#include "binaries.hpp"
+#include "clock.hpp"
 
 using namespace std;
 
@@ -163,13 +171,14 @@ private:
 
 	BootdirOption(void); // disallowed!
 
-	/*determine if a file does not end in .hlbc*/
+	/*determine if a file ends in ext*/
+	static bool ends_in(std::string const& file, std::string const& ext) {
+		if(file.size() < ext.size()) return false;
+		return equal(ext.begin(), ext.end(), file.end() - ext.size());
+	}
+	/*determine if a file does not end in .hlbc or .hlb*/
 	static bool if_not_hlbc(std::string const& file) {
-		/*if file is shorter than 5 chars, not .hlbc*/
-		if(file.size() < 5) return true;
-		std::string::const_iterator end = file.end();
-		std::string::const_iterator begin = end - 5;
-		return !equal(begin, end, ".hlbc");
+		return !ends_in(file, ".hlbc") && !ends_in(file, ".hlb");
 	}
 	/*appends two strings together*/
 
@@ -202,6 +211,26 @@ public:
 			}
 			/*now sort them*/
 			sort(files.begin(), files.end());
+			/*x.hlb sorts just before x.hlbc; prefer it,
+			unless x.hlbc has been changed since
+			*/
+			std::vector<std::string> kept;
+			for(size_t j = 0; j < files.size(); ++j) {
+				if(!kept.empty() && ends_in(files[j], ".hlbc") &&
+						kept.back() + "c" == files[j]) {
+					if(file_mtime(path + files[j]) >
+							file_mtime(path + kept.back())) {
+						cerr << "Warning: " << path + files[j]
+							<< " is newer than "
+							<< path + kept.back()
+							<< "; loading it instead" << endl;
+						kept.back() = files[j];
+					}
+					continue;
+				}
+				kept.push_back(files[j]);
+			}
+			files.swap(kept);
 			/*prepend with path*/
 			transform(files.begin(), files.end(), files.begin(), bind1st(std::plus<std::string>(), path));
 			return true;
@@ -221,31 +250,272 @@ public:
 	}
 };
 
+/* --name N, storing N into a size_t */
+class SizeOption : public Option {
+private:
+	char const* nm;
+	char const* desc;
+	size_t& target;
+
+	SizeOption(void); // disallowed!
+
+public:
+	SizeOption(char const* nnm, size_t& ntarget, char const* ndesc)
+		: nm(nnm), desc(ndesc), target(ntarget) { }
+
+	virtual bool parse_option(char* argv[], int argc, int& i) {
+		if(i + 1 < argc) {
+			++i;
+			char* end;
+			unsigned long v = strtoul(argv[i], &end, 10);
+			if(end == argv[i] || *end != '\0') {
+				cerr << name() << " expects a number, got "
+					<< argv[i] << endl;
+				return false;
+			}
+			target = v;
+			return true;
+		} else {
+			cerr << name() << " requires a number" << endl;
+			return false;
+		}
+	}
+	virtual const char* name(void) {
+		return nm;
+	}
+	virtual void usage(void) {
+		cout << name() << " N\n\t" << desc << "\n";
+	}
+};
+
+/* --name S, storing S into a std::string */
+class StringOption : public Option {
+private:
+	char const* nm;
+	char const* arg;
+	char const* desc;
+	std::string& target;
+
+	StringOption(void); // disallowed!
+
+public:
+	StringOption(char const* nnm, std::string& ntarget,
+			char const* narg, char const* ndesc)
+		: nm(nnm), arg(narg), desc(ndesc), target(ntarget) { }
+
+	virtual bool parse_option(char* argv[], int argc, int& i) {
+		if(i + 1 < argc) {
+			++i;
+			target = argv[i];
+			return true;
+		} else {
+			cerr << name() << " requires an argument" << endl;
+			return false;
+		}
+	}
+	virtual const char* name(void) {
+		return nm;
+	}
+	virtual void usage(void) {
+		cout << name() << " " << arg << "\n\t" << desc << "\n";
+	}
+};
+
+/* --name, setting a bool */
+class FlagOption : public Option {
+private:
+	char const* nm;
+	char const* desc;
+	bool& target;
+
+	FlagOption(void); // disallowed!
+
+public:
+	FlagOption(char const* nnm, bool& ntarget, char const* ndesc)
+		: nm(nnm), desc(ndesc), target(ntarget) { }
+
+	virtual bool parse_option(char* argv[], int argc, int& i) {
+		target = 1;
+		return true;
+	}
+	virtual const char* name(void) {
+		return nm;
+	}
+	virtual void usage(void) {
+		cout << name() << "\n\t" << desc << "\n";
+	}
+};
+
+/* --history off|sampled|full */
+class HistoryOption : public Option {
+public:
+	virtual bool parse_option(char* argv[], int argc, int& i) {
+		if(i + 1 < argc) {
+			++i;
+			std::string m = argv[i];
+			if(m == "off") {
+				History::mode = History::history_off;
+			} else if(m == "sampled") {
+				History::mode = History::history_sampled;
+			} else if(m == "full") {
+				History::mode = History::history_full;
+			} else {
+				cerr << name() << " expects off, sampled or full, got "
+					<< m << endl;
+				return false;
+			}
+			return true;
+		} else {
+			cerr << name() << " requires an argument" << endl;
+			return false;
+		}
+	}
+	virtual const char* name(void) {
+		return "--history";
+	}
+	virtual void usage(void) {
+		cout << name() << " off|sampled|full\n\t"
+			"record every call for backtraces (full, the default),\n\t"
+			"only one call in every --history-sample calls, or none\n";
+	}
+};
+
 /*--------------------------------------------------------------------------
 Multifile bootstrap
 --------------------------------------------------------------------------*/
 
-void load_into_process(Process& proc, std::string const& file) {
+/*report the size of each file loaded, and how long it took*/
+bool load_report = 0;
+
+static void report_load(std::string const& file, size_t bytes,
+		uint64_t start, uint64_t read, uint64_t assembled) {
+	uint64_t usec = read - start;
+	cerr << file << ": " << bytes << " bytes read in "
+		<< usec / 1000 << "." << (usec % 1000) / 100 << " ms";
+	if(usec) {
+		cerr << " (" << (bytes / usec) << "."
+			<< (bytes * 10 / usec) % 10 << " MB/s)";
+	}
+	usec = assembled - read;
+	cerr << ", assembled in " << usec / 1000 << "."
+		<< (usec % 1000) / 100 << " ms" << endl;
+}
+
+/*leaves the Bytecode in file, text or .hlb, on the stack*/
+void assemble_file(Process& proc, std::string const& file) {
+	uint64_t start = monotonic_usec();
+	std::vector<char> dat;
 	{
-		ifstream in(file.c_str());
+		ifstream in(file.c_str(), ios::binary);
 		if (!in) {
 			cerr << "Can't open file: " << file << endl;
 			exit(2);
 		}
-		read_sequence(proc, in);
+		in.seekg(0, ios::end);
+		dat.resize(in.tellg());
+		in.seekg(0, ios::beg);
+		if (!dat.empty()) in.read(&dat[0], dat.size());
+	}
+	uint64_t read;
+	if (is_hlb(dat)) {
+		/*the bodies are assembled as they are loaded*/
+		load_hlb(proc, dat);
+		read = monotonic_usec();
+	} else {
+		char const* text = dat.empty() ? "" : &dat[0];
+		read_sequence(proc, text, text + dat.size());
+		read = monotonic_usec();
+		assembler.go(proc);
+	}
+	if (load_report) {
+		report_load(file, dat.size(), start, read, monotonic_usec());
 	}
-	assembler.go(proc);
+}
+
+/*makes the Bytecode on the stack top the body of the process*/
+static void run_loaded(Process& proc) {
 	Closure *k = Closure::NewClosure(proc, 0);
 	k->codereset(proc.stack.top());
 	proc.stack.top() = Object::to_ref(k);
 	proc.stack.restack(1);
 }
 
+void load_into_process(Process& proc, std::string const& file) {
+	assemble_file(proc, file);
+	run_loaded(proc);
+}
+
 /*mutex is not strictly necessary except to shut helgrind up*/
 AppMutex boot_next_mtx;
+std::vector<std::string>::const_iterator boot_begin;
 std::vector<std::string>::const_iterator boot_next;
 std::vector<std::string>::const_iterator boot_end;
 
+/*Reading and assembling a boot file doesn't depend on running
+the ones before it, so the files after the first are read and
+assembled ahead by helper threads, each in a Process of its
+own, and copied out into a ValueHolder.  GoNextBoot then only
+waits for the next one and adopts its ValueHolder.
+*/
+size_t load_threads = 2;
+
+class PreloadedBoot : boost::noncopyable {
+public:
+	bool done;
+	ValueHolderRef code;
+	std::string err;
+	PreloadedBoot(void) : done(0), code(), err() { }
+};
+
+AppMutex preload_mtx;
+AppCondVar preload_cv;
+boost::scoped_array<PreloadedBoot> preloaded;
+size_t preload_next;
+size_t preload_end;
+
+class BootPreloader {
+public:
+	void operator()(void) {
+		for(;;) {
+			size_t i;
+			{AppLock l(preload_mtx);
+				if(preload_next == preload_end) return;
+				i = preload_next++;
+			}
+			ValueHolderRef code;
+			std::string err;
+			std::string const& file = boot_begin[i];
+			try {
+				Process p;
+				assemble_file(p, file);
+				ValueHolder::copy_object(code, p.stack.top());
+			} catch(HlError& h) {
+				err = file + ": " + h.err_str();
+			}
+			{AppLock l(preload_mtx);
+				preloaded[i].code.swap(code);
+				preloaded[i].err = err;
+				preloaded[i].done = 1;
+			}
+			preload_cv.broadcast();
+		}
+	}
+};
+
+static void run_preloaded(Process& proc, size_t i) {
+	ValueHolderRef code;
+	std::string err;
+	{AppLock l(preload_mtx);
+		while(!preloaded[i].done) preload_cv.wait(l);
+		code.swap(preloaded[i].code);
+		err = preloaded[i].err;
+	}
+	if(!err.empty()) throw_HlError(err.c_str());
+	proc.stack.push(code.value());
+	proc.other_spaces.insert(code);
+	run_loaded(proc);
+}
+
 bool GoNextBoot::run(Process& proc, size_t& reductions) {
 	std::vector<std::string>::const_iterator it;
 	{AppLock l(boot_next_mtx);
@@ -255,7 +525,11 @@ bool GoNextBoot::run(Process& proc, size_t& reductions) {
 		}
 		++boot_next;
 	}
-	load_into_process(proc, *it);
+	if(preloaded) {
+		run_preloaded(proc, it - boot_begin);
+	} else {
+		load_into_process(proc, *it);
+	}
 	return true;
 construct_halting:
 	proc.stack.push(Assembler::inline_assemble(proc, "(<bc>halt)"));
@@ -267,6 +541,34 @@ construct_halting:
 	return true;
 }
 
+/*assembles each file, and writes it as .hlb in place of its
+extension
+*/
+int emit_hlb(std::vector<std::string> const& files) {
+	for(size_t i = 0; i < files.size(); ++i) {
+		std::string out = files[i];
+		std::string::size_type dot = out.rfind('.');
+		if(dot != std::string::npos && out.find('/', dot) == std::string::npos) {
+			out.erase(dot);
+		}
+		out += ".hlb";
+		try {
+			Process p;
+			assemble_file(p, files[i]);
+			ofstream o(out.c_str(), ios::binary);
+			if(!o) {
+				cerr << "Can't open file: " << out << endl;
+				return 2;
+			}
+			write_hlb(o, *expect_type<Bytecode>(p.stack.top()));
+		} catch(HlError& h) {
+			cerr << files[i] << ": " << h.err_str() << endl;
+			return 1;
+		}
+	}
+	return 0;
+}
+
 /*--------------------------------------------------------------------------
 Main
 --------------------------------------------------------------------------*/
@@ -280,9 +582,134 @@ int main(int argc, char **argv) {
 	opt.add_option(&bytecodes);
 	opt.add_option(&bootdir);
 
+	ProcessGCPolicy& gcp = AllWorkers::getInstance().gc_policy;
+	SizeOption gc_min_procs("--gc-min-procs", gcp.min_processes,
+		"minimum number of processes spawned before a process GC");
+	SizeOption gc_proc_growth("--gc-proc-growth", gcp.process_growth,
+		"start a process GC when this percentage of the processes\n\t"
+		"that survived the last one has been spawned since");
+	SizeOption gc_min_heap("--gc-min-heap", gcp.min_heap_bytes,
+		"minimum growth in bytes of all process heaps before a\n\t"
+		"process GC");
+	SizeOption gc_heap_growth("--gc-heap-growth", gcp.heap_growth,
+		"start a process GC when all process heaps have grown by\n\t"
+		"this percentage of what survived the last one");
+	FlagOption gc_report("--gc-report", gcp.report,
+		"report the processes reclaimed by each process GC\n\t"
+		"and the time it took on stderr");
+	opt.add_option(&gc_min_procs);
+	opt.add_option(&gc_proc_growth);
+	opt.add_option(&gc_min_heap);
+	opt.add_option(&gc_heap_growth);
+	opt.add_option(&gc_report);
+
+	AllWorkers& workers = AllWorkers::getInstance();
+	StringOption trace_sched("--trace-scheduler", workers.trace_file,
+		"file", "record each worker's scheduling events and write\n\t"
+		"them to file as a Chrome trace (chrome://tracing) at exit");
+	SizeOption trace_size("--trace-size", workers.trace_size,
+		"number of scheduling events kept per worker when tracing;\n\t"
+		"older events are dropped");
+	opt.add_option(&trace_sched);
+	opt.add_option(&trace_size);
+
+	#ifdef BYTECODE_PROFILE
+		FlagOption profile_bytecodes("--profile-bytecodes",
+			workers.profile_bytecodes,
+			"count the executions and cycles of each bytecode and\n\t"
+			"function, and report them on stderr at exit");
+		opt.add_option(&profile_bytecodes);
+	#endif
+
+	StringOption sample_file("--sample-file", Sampler::file,
+		"file", "sample the running functions and their callers\n\t"
+		"on a CPU-time timer, and write them to file as folded\n\t"
+		"stacks (for flamegraph tools) at exit");
+	SizeOption sample_interval("--sample-interval",
+		Sampler::interval_usec,
+		"microseconds of CPU time between stack samples");
+	opt.add_option(&sample_file);
+	opt.add_option(&sample_interval);
+
+	StringOption metrics_file("--metrics-file", workers.metrics_file,
+		"file", "append each scheduler metrics sample to file");
+	SizeOption metrics_interval("--metrics-interval",
+		workers.metrics_interval_ms,
+		"milliseconds between the samples appended to\n\t"
+		"--metrics-file; 0 (the default) appends one only when\n\t"
+		"the run starts and ends");
+	opt.add_option(&metrics_file);
+	opt.add_option(&metrics_interval);
+
+	HistoryOption history;
+	SizeOption history_sample("--history-sample", History::sample_period,
+		"with --history sampled, record one call in every N");
+	opt.add_option(&history);
+	opt.add_option(&history_sample);
+
+	SizeOption opt_level("--opt-level", assembler.opt_level,
+		"bytecode optimization: 0 assembles bytecode as written,\n\t"
+		"1 also folds constants and drops dead branches,\n\t"
+		"2 (the default) also fuses common runs of bytecodes");
+	opt.add_option(&opt_level);
+
+	SizeOption asm_cache_opt("--assemble-cache", AssemblyCache::capacity,
+		"number of sequences <impl>assemble remembers, so that\n\t"
+		"assembling one of them again only copies the result;\n\t"
+		"0 always assembles (default 256)");
+	opt.add_option(&asm_cache_opt);
+
+	size_t code_space_size = CodeSpace::default_size;
+	SizeOption code_space_opt("--code-space", code_space_size,
+		"bytes set aside for the bodies of globals, which every\n\t"
+		"process then shares instead of copying; only the part\n\t"
+		"used takes memory.  0 shares nothing (default 64 MB)");
+	opt.add_option(&code_space_opt);
+
+	FlagOption load_report_opt("--load-report", load_report,
+		"report the size of each --bc file, how long it took to\n\t"
+		"read and assemble, and the rate it was read at on stderr");
+	opt.add_option(&load_report_opt);
+
+	#ifndef single_threaded
+		SizeOption load_threads_opt("--load-threads", load_threads,
+			"number of threads reading and assembling the --bc files\n\t"
+			"after the first ahead of running them; 0 reads each\n\t"
+			"only when it is about to run");
+		opt.add_option(&load_threads_opt);
+	#endif
+
+	bool emit = 0;
+	FlagOption emit_hlb_opt("--emit-hlb", emit,
+		"don't run anything: assemble each --bc file and write\n\t"
+		"it as precompiled bytecode, replacing its extension\n\t"
+		"with .hlb; .hlb files load without the reader and\n\t"
+		"the assembler");
+	opt.add_option(&emit_hlb_opt);
+
+	std::string save_image_file;
+	std::string load_image_file;
+	StringOption save_image_opt("--save-image", save_image_file,
+		"file", "once every process has ended, write the value of\n\t"
+		"every global to file as a boot image");
+	StringOption load_image_opt("--load-image", load_image_file,
+		"file", "bind the globals saved in the boot image file\n\t"
+		"before running anything, in place of running the\n\t"
+		"boot files that made it");
+	opt.add_option(&save_image_opt);
+	opt.add_option(&load_image_opt);
+
+	#ifdef HAVE_JIT
+		SizeOption jit_threshold("--jit-threshold", Jit::threshold,
+			"compile a function to native code once it has been\n\t"
+			"called this many times; 0 never compiles");
+		opt.add_option(&jit_threshold);
+	#endif
+
 	if (!opt.parse(argv, argc)) {
 		return 1;
 	}
+	code_space.reset(code_space_size);
 
 	#ifndef single_threaded
 		single_threaded = 1;
@@ -308,13 +735,38 @@ int main(int argc, char **argv) {
 		cerr << "Nothing to do; please try `hlvma --help' for how to execute hlvma" << endl;
 		exit(1);
 	}
+	if(emit) return emit_hlb(files);
+
+	if(!load_image_file.empty()) {
+		try {
+			Process q;
+			load_image(q, load_image_file);
+		} catch(HlError& h) {
+			cerr << "Error: " << h.err_str() << endl;
+			return 1;
+		}
+	}
 
 	std::vector<std::string>::const_iterator it = files.begin();
 	{AppLock l(boot_next_mtx);
+		boot_begin = it;
 		boot_next = it; ++boot_next;
 		boot_end = files.end();
 	}
 
+	#ifndef single_threaded
+		std::vector<Thread<BootPreloader>*> preloaders;
+		if(load_threads && files.size() > 2) {
+			preloaded.reset(new PreloadedBoot[files.size()]);
+			preload_next = 1;
+			preload_end = files.size();
+			for(size_t i = 0; i < load_threads && i + 1 < files.size(); ++i) {
+				preloaders.push_back(
+					new Thread<BootPreloader>(BootPreloader()));
+			}
+		}
+	#endif
+
 	try {
 		p = new Process();
 		load_into_process(*p, *it);
@@ -323,9 +775,17 @@ int main(int argc, char **argv) {
 		ValueHolderRef rv;
 		w.initiate(3, p, rv);
 		cout << rv.value() << endl; // print return value
+		if(!save_image_file.empty()) save_image(save_image_file);
 	} catch(HlError& h) {
 		cerr << "Error: " << h.err_str() << endl;
 	}
 
+	#ifndef single_threaded
+		for(size_t i = 0; i < preloaders.size(); ++i) {
+			preloaders[i]->join();
+			delete preloaders[i];
+		}
+	#endif
+
 	return 0;
 }
@@ -6,18 +6,50 @@
 #include"assembler.hpp"
 #include"reader.hpp"
 
+#include<algorithm>
+
 void throw_HlError(const char *str) {
   //std::cerr << "Error: " << str << "\n";
 	//exit(1);
 	throw HlError(str);
 }
 
+void ProcessStack::make_room(size_t n) {
+	size_t live = size();
+	size_t cap = lim - mem;
+	if(live + n <= cap / 2) {
+		/*at least half the buffer is dead frames below
+		the base: slide the live frame down
+		*/
+		std::copy(base, tp, mem);
+	} else {
+		size_t ncap = cap ? cap * 2 : 16;
+		while(ncap < live + n) ncap *= 2;
+		Object::ref* nmem = new Object::ref[ncap];
+		std::copy(base, tp, nmem);
+		/*the old buffer is freed only after base points to
+		the new one, since the stack sampler may read the
+		frame from a signal handler at any time
+		*/
+		Object::ref* omem = mem;
+		mem = nmem;
+		lim = mem + ncap;
+		base = mem;
+		tp = mem + live;
+		delete[] omem;
+		return;
+	}
+	base = mem;
+	tp = mem + live;
+}
+
 bool MailBox::receive_message(ValueHolderRef& M, bool& is_waiting) {
 	is_waiting = false;
 	AppTryLock l(parent.mtx);
 	if(!l) return false; /*failed to lock, retry later*/
 	if(parent.stat == process_dead) return true; /*silently succeed*/
 	parent.the_mailbox.insert(M);
+	++parent.the_mailbox_size;
 	if(parent.stat == process_waiting) {
 		is_waiting = true;
 		parent.stat = process_running;
@@ -37,6 +69,7 @@ bool MailBox::extract_message(Object::ref& M) {
 			parent.stat = process_waiting;
 			return false;
 		}
+		--parent.the_mailbox_size;
 	}
 	/*Save the received message's Semispace into
 	  the heap's other spaces
@@ -53,6 +86,7 @@ bool MailBox::try_extract_message(Object::ref& M, bool& has_message) {
 		AppTryLock l(parent.mtx);
 		if(!l) return false;
 		parent.the_mailbox.remove(ref);
+		if(!ref.empty()) --parent.the_mailbox_size;
 	}
 	if(ref.empty()) {
 		return true;
@@ -96,13 +130,18 @@ public:
 	}
 };
 
-void MailBox::traverse(HeapTraverser* ht) {
+void MailBox::traverse_pids(HeapTraverser* ht) {
 	ValueHolderRefLockingReturner tmp(parent.mtx, parent.the_mailbox);
 	if(!tmp.ref.empty()) {
-		tmp.ref->traverse_objects(ht);
+		tmp.ref->traverse_pids(ht);
 	}
 }
 
+size_t MailBox::size(void) {
+	AppLock l(parent.mtx);
+	return parent.the_mailbox_size;
+}
+
 HlPid* Process::spawn(Object::ref cont) {
 	Process *spawned;
 	try {
@@ -152,6 +191,21 @@ bool Process::waiting_and_not_black(void) {
 	return (stat == process_waiting || stat == process_dead) && !black;
 }
 
+bool Process::grayen(void) {
+	AppLock l(mtx);
+	if(black || gray) return false;
+	gray = true;
+	return true;
+}
+
+bool Process::grayen_if_waiting(void) {
+	AppLock l(mtx);
+	if(black || gray) return false;
+	if(stat != process_waiting && stat != process_dead) return false;
+	gray = true;
+	return true;
+}
+
 bool Process::anesthesize(void) {
 	AppLock l(mtx);
 	if(stat == process_waiting && !black) {
@@ -185,7 +239,9 @@ bool Process::unanesthesize(void) {
 void Process::kill(void) {
 	stat = process_dead;
 	the_mailbox.reset();
+	the_mailbox_size = 0;
 	global_cache.clear();
+	clear_impl_cache();
 	invalid_globals.clear();
 	free_heap();
 }
@@ -193,11 +249,13 @@ void Process::atomic_kill(void) {
 	{AppLock l(mtx);
 		stat = process_dead;
 		the_mailbox.reset();
+		the_mailbox_size = 0;
 	}
 	/*used only when running anyway; since we're dead,
 	no need to lock
 	*/
 	global_cache.clear();
+	clear_impl_cache();
 	/*lock notification_mtx in case someone decides to
 	notify us at this time
 	*/
@@ -221,6 +279,10 @@ void Process::invalidate_changed_globals(void) {
 		temp.swap(invalid_globals);
 	}
 	typedef std::map<Symbol*, Object::ref> cache_map;
+	/*globals hardly ever change once running, so just
+	read all of the ImplBody values again
+	*/
+	if(!temp.empty()) clear_impl_cache();
 	/*work on temp*/
 	for(size_t i = 0; i < temp.size(); ++i) {
 		cache_map::iterator it = global_cache.find(temp[i]);
@@ -257,11 +319,13 @@ void Process::global_write(Symbol* S, Object::ref o) {
 	if(it != global_cache.end()) {
 		global_cache.erase(it);
 	}
+	clear_impl_cache();
 	S->set_value(o);
 }
 
 void Process::global_acquire( void ) {
 	global_cache.clear();
+	clear_impl_cache();
 }
 
 /*
@@ -277,6 +341,9 @@ void Process::scan_root_object(GenericTraverser* gt) {
 	for(it = global_cache.begin(); it != global_cache.end(); ++it) {
 		gt->traverse(it->second);
 	}
+	for(size_t i = 0; i < impl_body_count; ++i) {
+		gt->traverse(impl_cache[i]);
+	}
 	gt->traverse(bytecode_slot);
         // scan extra roots
         for (std::vector<Object::ref*>::iterator it = extra_roots.begin(); 
@@ -287,6 +354,7 @@ void Process::scan_root_object(GenericTraverser* gt) {
 	/*insert code for traversing process-local vars here*/
 	gt->traverse(proc_local_slot);
 	gt->traverse(err_handler_slot);
+	if(history_ring) history_ring->traverse_references(gt);
 }
 
 /*
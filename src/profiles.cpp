@@ -0,0 +1,128 @@
+#include"all_defines.hpp"
+
+#include"profiles.hpp"
+#include"reader.hpp" // for operator<<(std::ostream&, Object::ref)
+
+#include<vector>
+#include<sstream>
+#include<iomanip>
+#include<algorithm>
+#include<cstring>
+
+/*-----------------------------------------------------------------------------
+BytecodeProfile
+-----------------------------------------------------------------------------*/
+
+BytecodeProfile::BytecodeProfile(void)
+	: bodies(), op(0), body(0), body_code(0), last(0) {
+	std::memset(ops, 0, sizeof(ops));
+}
+
+void BytecodeProfile::hit(size_t i, char const* name) {
+	charge(cycle_counter());
+	op = &ops[i];
+	op->name = name;
+	++op->count;
+	if(body) ++body->ops;
+}
+
+std::string describe_body(Bytecode& b) {
+	std::ostringstream where;
+	if(b.get_name() != Object::nil()) {
+		where << b.get_name();
+	} else {
+		where << "<anonymous>@" << (void const*) b.getCode();
+	}
+	if(b.get_file() != Object::nil()) {
+		where << " " << b.get_file() << ":" << b.get_line();
+	}
+	return where.str();
+}
+
+void BytecodeProfile::enter_body(Bytecode& b) {
+	body_code = b.getCode();
+	body_map::iterator it = bodies.find(body_code);
+	if(it == bodies.end()) {
+		Body nb;
+		nb.where = describe_body(b);
+		nb.calls = nb.ops = nb.cycles = 0;
+		it = bodies.insert(std::make_pair(body_code, nb)).first;
+	}
+	body = &it->second;
+}
+
+void BytecodeProfile::merge(BytecodeProfile const& o) {
+	for(size_t i = 0; i <= __null_bytecode; ++i) {
+		if(!o.ops[i].name) continue;
+		ops[i].name = o.ops[i].name;
+		ops[i].count += o.ops[i].count;
+		ops[i].cycles += o.ops[i].cycles;
+	}
+	for(body_map::const_iterator it = o.bodies.begin();
+			it != o.bodies.end(); ++it) {
+		body_map::iterator mine = bodies.find(it->first);
+		if(mine == bodies.end()) {
+			bodies.insert(*it);
+		} else {
+			mine->second.calls += it->second.calls;
+			mine->second.ops += it->second.ops;
+			mine->second.cycles += it->second.cycles;
+		}
+	}
+}
+
+template<class T>
+static bool more_cycles(T const* a, T const* b) {
+	return a->cycles > b->cycles;
+}
+
+static double percent(uint64_t x, uint64_t total) {
+	return total ? 100.0 * x / total : 0.0;
+}
+
+void BytecodeProfile::report(std::ostream& o) const {
+	std::vector<Op const*> vops;
+	uint64_t total = 0;
+	uint64_t count = 0;
+	for(size_t i = 0; i <= __null_bytecode; ++i) {
+		if(!ops[i].name) continue;
+		vops.push_back(&ops[i]);
+		total += ops[i].cycles;
+		count += ops[i].count;
+	}
+	std::sort(vops.begin(), vops.end(), &more_cycles<Op>);
+	o << "bytecode profile: " << count << " bytecodes, "
+	  << total << " cycles" << std::endl;
+	o << std::setw(16) << "cycles" << std::setw(8) << "%"
+	  << std::setw(14) << "count" << std::setw(10) << "cyc/op"
+	  << "  bytecode" << std::endl;
+	o << std::fixed << std::setprecision(2);
+	for(size_t i = 0; i < vops.size(); ++i) {
+		Op const& op = *vops[i];
+		o << std::setw(16) << op.cycles
+		  << std::setw(8) << percent(op.cycles, total)
+		  << std::setw(14) << op.count
+		  << std::setw(10) << (op.count ? (double) op.cycles / op.count : 0.0)
+		  << "  " << op.name << std::endl;
+	}
+
+	std::vector<Body const*> vbodies;
+	for(body_map::const_iterator it = bodies.begin();
+			it != bodies.end(); ++it) {
+		vbodies.push_back(&it->second);
+	}
+	std::sort(vbodies.begin(), vbodies.end(), &more_cycles<Body>);
+	o << std::endl;
+	o << std::setw(16) << "cycles" << std::setw(8) << "%"
+	  << std::setw(14) << "calls" << std::setw(14) << "bytecodes"
+	  << "  function" << std::endl;
+	for(size_t i = 0; i < vbodies.size(); ++i) {
+		Body const& b = *vbodies[i];
+		o << std::setw(16) << b.cycles
+		  << std::setw(8) << percent(b.cycles, total)
+		  << std::setw(14) << b.calls
+		  << std::setw(14) << b.ops
+		  << "  " << b.where << std::endl;
+	}
+}
+
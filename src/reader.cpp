@@ -7,26 +7,183 @@
 
 #include <iostream>
 #include <sstream>
+#include <iterator>
+#include <cstdlib>
 
 static const char bc_start = '(';
 static const char bc_end = ')';
-static const char *separators = " \n\t";
 
-void skip_seps(std::istream & in) {
-  while (!in.eof() && strchr(separators, in.peek())) 
-    in.get();
+/*-----------------------------------------------------------------------------
+Lexer
+-----------------------------------------------------------------------------*/
+
+/*what each byte can be in the text of a bytecode sequence*/
+enum CharClass {
+  ch_atom,      // part of a mnemonic, number or symbol
+  ch_sep,       // whitespace between them
+  ch_start,     // (
+  ch_end        // )
+};
+
+class CharClasses {
+private:
+  unsigned char tb[256];
+public:
+  CharClasses() {
+    for (size_t i = 0; i < 256; ++i) tb[i] = ch_atom;
+    tb[(unsigned char) ' '] = ch_sep;
+    tb[(unsigned char) '\t'] = ch_sep;
+    tb[(unsigned char) '\n'] = ch_sep;
+    tb[(unsigned char) '\r'] = ch_sep;
+    tb[(unsigned char) bc_start] = ch_start;
+    tb[(unsigned char) bc_end] = ch_end;
+  }
+  CharClass operator[](char c) const {
+    return (CharClass) tb[(unsigned char) c];
+  }
+};
+
+static const CharClasses char_class;
+
+/*parses all of [s, e) as an optionally signed decimal
+integer that fits in an int64_t
+*/
+static bool parse_int(char const* s, char const* e, int64_t & x) {
+  bool neg = false;
+  if (s != e && (*s == '-' || *s == '+')) { neg = (*s == '-'); ++s; }
+  /*18 digits never overflow*/
+  if (s == e || e - s > 18) return false;
+  int64_t v = 0;
+  for (; s != e; ++s) {
+    if (*s < '0' || *s > '9') return false;
+    v = v * 10 + (*s - '0');
+  }
+  x = neg ? -v : v;
+  return true;
+}
+
+/*parses all of [s, e) as a decimal float with a point, and an
+optional exponent.  Values whose digits and exponent are both
+small are computed exactly with one multiplication or division;
+the rest go through strtod.
+*/
+static bool parse_float(char const* s, char const* e, double & d) {
+  static const double pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  char const* p = s;
+  bool neg = false;
+  if (p != e && (*p == '-' || *p == '+')) { neg = (*p == '-'); ++p; }
+  uint64_t mant = 0;
+  int digits = 0;     // significant digits in mant
+  int scale = 0;      // mant is scaled by 10^scale
+  bool any = false;
+  bool point = false;
+  for (; p != e; ++p) {
+    if (*p >= '0' && *p <= '9') {
+      any = true;
+      if (digits < 19) {
+        mant = mant * 10 + (*p - '0');
+        if (mant) ++digits;
+        if (point) --scale;
+      } else if (!point) {
+        ++scale;
+      }
+    } else if (*p == '.' && !point) {
+      point = true;
+    } else {
+      break;
+    }
+  }
+  if (!any || !point) return false;
+  if (p != e && (*p == 'e' || *p == 'E')) {
+    ++p;
+    bool eneg = false;
+    if (p != e && (*p == '-' || *p == '+')) { eneg = (*p == '-'); ++p; }
+    if (p == e) return false;
+    int ex = 0;
+    for (; p != e; ++p) {
+      if (*p < '0' || *p > '9') return false;
+      if (ex < 10000) ex = ex * 10 + (*p - '0');
+    }
+    scale += eneg ? -ex : ex;
+  }
+  if (p != e) return false;
+  if (mant < ((uint64_t) 1 << 53) && scale >= -22 && scale <= 22) {
+    d = (double) mant;
+    if (scale < 0) d /= pow10[-scale];
+    else d *= pow10[scale];
+  } else {
+    std::string tmp(s, e);
+    d = strtod(tmp.c_str(), NULL);
+    return true;
+  }
+  if (neg) d = -d;
+  return true;
+}
+
+namespace {
+
+/*reads bytecode sequences out of a buffer, leaving them on the
+stack as the conses the assembler takes
+*/
+class Reader {
+private:
+  Process & proc;
+  char const* pt;
+  char const* end;
+
+  void skip_seps() {
+    while (pt != end && char_class[*pt] == ch_sep) ++pt;
+  }
+  bool at_eof() const { return pt == end; }
+  /*the atom starting at pt, which is left just past it*/
+  void token(char const* & s, char const* & e) {
+    s = pt;
+    while (pt != end && char_class[*pt] == ch_atom) ++pt;
+    e = pt;
+  }
+  void atom(char const* s, char const* e);
+
+public:
+  Reader(Process & nproc, char const* nstart, char const* nend)
+    : proc(nproc), pt(nstart), end(nend) { }
+  char const* position() const { return pt; }
+  void bytecode();
+  void sequence();
+};
+
+}
+
+// read a number or a symbol, leave it on the stack
+void Reader::atom(char const* s, char const* e) {
+  int64_t i;
+  double f;
+  BigValue v;
+  char c = *s;
+  bool numeric = c == '-' || c == '+' || c == '.' || (c >= '0' && c <= '9');
+  // BigValue takes no '+'; "+-1" stays a symbol
+  char const* ds = (c == '+' && e - s > 1 && s[1] != '-') ? s + 1 : s;
+  if (numeric && parse_int(s, e, i) &&
+      i >= Object::smallint_min && i <= Object::smallint_max)
+    proc.stack.push(Object::to_ref((int) i));
+  else if (numeric && BigValue::from_string(std::string(ds, e), v))
+    proc.stack.push(BigInt::mk(proc, v)); // too large for a smallint
+  else if (numeric && parse_float(s, e, f))
+    proc.stack.push(Float::mk(proc, f));
+  else // it's a symbol
+    proc.stack.push(Object::to_ref(symbols->lookup(s, e - s)));
 }
 
 // read a sequence of bytecodes in a list left on the stack
-void read_sequence(Process & proc, std::istream & in) {
-  char c;
+void Reader::sequence() {
   proc.stack.push(Object::nil()); // head
   proc.stack.push(Object::nil()); // tail
   while (1) {
-    skip_seps(in);
-    c = in.peek();
-    if (!in.eof() && c == bc_start) {
-      read_bytecode(proc, in);
+    skip_seps();
+    if (!at_eof() && *pt == bc_start) {
+      bytecode();
       Object::ref c2 = Object::to_ref(proc.create<Cons>());
       if (proc.stack.top(3)==Object::nil()) // test the head
         proc.stack.top(3) = c2; // new head
@@ -41,55 +198,16 @@ void read_sequence(Process & proc, std::istream & in) {
   proc.stack.pop(); // remove tail and leave head
 }
 
-// read a string until a separator character is found
-std::string read_upto(std::istream & in) {
-  static const char *no_sym = " \t\n()";
-  std::string res;
-  char c;
-  c = in.peek();
-  while (!in.eof() && strchr(no_sym, c)==NULL) {
-    res += in.get();
-    c = in.peek();
-  }
-  if (res=="") 
-    in.setstate(std::ios_base::badbit);
-  return res;
-}
-
-// read a number or a symbol, leave it on the stack
-void read_atom(Process & proc, std::istream & in) {
-  std::string res = read_upto(in);
-  std::stringstream s(res);
-  if (res.find('.')!=-1) { // try to parse a float
-    double f;
-    s >> f;
-    if (!s) // it's a symbol
-      proc.stack.push(Object::to_ref(symbols->lookup(res)));
-    else
-      proc.stack.push(Object::to_ref(Float::mk(proc, f)));
-  }
-  else { // try to parse an int
-    int i;
-    s >> i; 
-    if (!s) // it's a symbol
-      proc.stack.push(Object::to_ref(symbols->lookup(res)));   
-    else
-      proc.stack.push(Object::to_ref(i));
-  }
-}
-
-void read_bytecode(Process & proc, std::istream & in) {
+void Reader::bytecode() {
   // !! the created object must stay on the stack for correct
   // !! collection
   proc.stack.push(Object::to_ref(proc.create<Cons>()));
-  if (!in)
-    throw_HlError("Input stream is invalid");
 
-  skip_seps(in);
-  if (in.eof())
+  skip_seps();
+  if (at_eof())
     return; // nothing to read
 
-  char c = in.get();
+  char c = *pt++;
   if (c != bc_start) {
     std::string err = "Unknown character at start of bytecode";
     err += " ";
@@ -97,37 +215,37 @@ void read_bytecode(Process & proc, std::istream & in) {
     throw_HlError(err.c_str());
   }
 
-  if (in.eof())
+  if (at_eof())
     throw_HlError("EOF");
 
-  std::string name = read_upto(in);
-  if (!in)
+  char const* s;
+  char const* e;
+  token(s, e);
+  if (s == e)
     throw_HlError("Can't read bytecode mnemonic");
-  Symbol *mnemonic = symbols->lookup(name);
+  Symbol *mnemonic = symbols->lookup(s, e - s);
   scar(proc.stack.top(), Object::to_ref(mnemonic));
 
-  skip_seps(in);
-  c = in.peek();
-  if (in.eof())
+  skip_seps();
+  if (at_eof())
     throw_HlError("EOF");
+  c = *pt;
   if (c == bc_end) { // single mnemonic
-    in.get();
+    ++pt;
     return;
   }
   if (c == bc_start) { // subsequence
-    read_sequence(proc, in);
+    sequence();
     Object::ref sub = proc.stack.top(); proc.stack.pop();
     scdr(proc.stack.top(), sub);
   } else { // simple arg
     Cons *c2 = proc.create<Cons>();
     scdr(proc.stack.top(), Object::to_ref(c2));
-    read_atom(proc, in);
-    if (!in)
-      throw_HlError("Can't read simple value");
-    skip_seps(in);
-    c = in.peek();
-    if (c == bc_start) { // simple arg followed by a sequence
-      read_sequence(proc, in);
+    token(s, e);
+    atom(s, e);
+    skip_seps();
+    if (!at_eof() && *pt == bc_start) { // simple arg followed by a sequence
+      sequence();
       Object::ref sub = proc.stack.top(); proc.stack.pop();
       Object::ref atom = proc.stack.top(); proc.stack.pop();
       scar(cdr(proc.stack.top()), atom);
@@ -138,14 +256,51 @@ void read_bytecode(Process & proc, std::istream & in) {
     }
   }
 
-  skip_seps(in);
-  c = in.get();
-  if (in.eof())
+  skip_seps();
+  if (at_eof())
     throw_HlError("EOF");
-  if (c != bc_end)
+  if (*pt++ != bc_end)
     throw_HlError("Spurious contents at end of bytecode");
 }
 
+/*-----------------------------------------------------------------------------
+Entry points
+-----------------------------------------------------------------------------*/
+
+char const* read_sequence(Process & proc, char const* start, char const* end) {
+  Reader r(proc, start, end);
+  r.sequence();
+  return r.position();
+}
+
+char const* read_bytecode(Process & proc, char const* start, char const* end) {
+  Reader r(proc, start, end);
+  r.bytecode();
+  return r.position();
+}
+
+/*the stream versions read all that is left of the stream into
+a buffer first
+*/
+static void slurp(std::istream & in, std::string & buf) {
+  if (!in)
+    throw_HlError("Input stream is invalid");
+  buf.assign(std::istreambuf_iterator<char>(in),
+             std::istreambuf_iterator<char>());
+}
+
+void read_sequence(Process & proc, std::istream & in) {
+  std::string buf;
+  slurp(in, buf);
+  read_sequence(proc, buf.data(), buf.data() + buf.size());
+}
+
+void read_bytecode(Process & proc, std::istream & in) {
+  std::string buf;
+  slurp(in, buf);
+  read_bytecode(proc, buf.data(), buf.data() + buf.size());
+}
+
 std::ostream& operator<<(std::ostream & out, Object::ref obj) {
   if (obj==Object::nil()) {
     out << "nil";
@@ -153,18 +308,22 @@ std::ostream& operator<<(std::ostream & out, Object::ref obj) {
     out << "t";
   }else if (is_a<int>(obj)) {
     out << as_a<int>(obj);
+  } else if (is_float(obj)) {
+    out.setf(std::ios::showpoint);
+    out << float_value(obj);
+    out.unsetf(std::ios::showpoint);
   } else if (is_a<Symbol*>(obj)) {
     out << as_a<Symbol*>(obj)->getPrintName();
   } else if (is_a<Generic*>(obj)) {
     Generic *g = as_a<Generic*>(obj);
-    Float *f;
     Cons *c;
     Closure *l;
     HlString *str;
-    if (f = dynamic_cast<Float*>(g)) {
-      out.setf(std::ios::showpoint);
-      out << f->get();
-      out.unsetf(std::ios::showpoint);
+    BigInt *bi;
+    if (bi = dynamic_cast<BigInt*>(g)) {
+      BigValue v;
+      bi->value(v);
+      out << v.to_string();
     } else if (c = dynamic_cast<Cons*>(g)) {
       out << "(" << c->car();
       Object::ref r = c->cdr();
@@ -0,0 +1,210 @@
+#include"all_defines.hpp"
+
+#include"samples.hpp"
+#include"processes.hpp"
+#include"profiles.hpp" // for describe_body
+#include"types.hpp"
+
+#include<sstream>
+#include<iostream>
+#include<cstring>
+#include<algorithm>
+
+#include<signal.h>
+#include<sys/time.h>
+
+Sampler sampler;
+
+std::string Sampler::file;
+size_t Sampler::interval_usec = 10000;
+size_t Sampler::buffer_size = 4096;
+
+/*-----------------------------------------------------------------------------
+SampleBuffer
+-----------------------------------------------------------------------------*/
+
+/*the buffer of the worker running on this thread, if any*/
+static __thread SampleBuffer* current_samples = 0;
+
+void SampleBuffer::attach(SampleBuffer* sb) {
+	current_samples = sb;
+}
+
+/*keeps the compiler from moving the writes of a sample past
+the update of head
+*/
+static inline void compiler_barrier(void) {
+	__asm__ __volatile__ ("" ::: "memory");
+}
+
+/*Runs in the signal handler, so it may interrupt the worker
+anywhere: it only reads, and relies on the stack buffer and
+the heap never being freed under it outside of a GC, which
+it stays away from.
+*/
+void SampleBuffer::take(void) {
+	size_t h = head;
+	if(h - tail == ring.size()) {
+		dropped = dropped + 1;
+		return;
+	}
+	Sample& s = ring[h % ring.size()];
+	s.depth = 0;
+	s.truncated = 0;
+	Process* P = running;
+	if(!P) {
+		s.kind = sample_scheduler;
+	} else if(P->collecting) {
+		s.kind = sample_gc;
+	} else {
+		s.kind = sample_hl;
+		Bytecode* b = maybe_exact_type<Bytecode>(P->bytecode_slot);
+		if(b) s.frames[s.depth++] = b->getCode();
+		/*find the continuation the running body returns to,
+		as History::to_list does
+		*/
+		ProcessStack& stack = P->stack;
+		size_t sz = stack.size();
+		Closure* k = 0;
+		if(sz > 1) {
+			k = maybe_exact_type<Closure>(stack[1]);
+			if(k && !k->continuation) k = 0;
+		}
+		if(!k && sz > 0) {
+			k = maybe_exact_type<Closure>(stack[0]);
+			if(k && !k->continuation) k = 0;
+		}
+		while(k) {
+			Bytecode* kb = maybe_exact_type<Bytecode>(k->code());
+			/*the running body may be the continuation itself*/
+			if(kb && !(s.depth == 1 && s.frames[0] == kb->getCode())) {
+				if(s.depth == max_depth) {
+					s.truncated = 1;
+					break;
+				}
+				s.frames[s.depth++] = kb->getCode();
+			}
+			Closure* parent = 0;
+			for(size_t i = 0; i < k->size(); ++i) {
+				Closure* c = maybe_exact_type<Closure>(k->index(i));
+				if(c && c->continuation) {
+					parent = c;
+					break;
+				}
+			}
+			k = parent;
+		}
+	}
+	compiler_barrier();
+	head = h + 1;
+}
+
+void SampleBuffer::drain(void) {
+	size_t h = head;
+	compiler_barrier();
+	for(size_t i = tail; i != h; ++i) {
+		Sample const& s = ring[i % ring.size()];
+		Stack key(s.kind, std::vector<bytecode_t const*>(
+			s.frames, s.frames + s.depth));
+		/*mark a truncated chain with a null root*/
+		if(s.truncated) key.second.push_back(0);
+		++stacks[key];
+	}
+	compiler_barrier();
+	tail = h;
+}
+
+static void sigprof_handler(int) {
+	SampleBuffer* sb = current_samples;
+	if(sb) sb->take();
+}
+
+/*-----------------------------------------------------------------------------
+Sampler
+-----------------------------------------------------------------------------*/
+
+void Sampler::name(Bytecode& b) {
+	bytecode_t const* code = b.getCode();
+	if(!code) return;
+	Body nb;
+	nb.code = b.getCodeArray();
+	nb.where = describe_body(b);
+	/*';' separates frames in the folded format*/
+	std::replace(nb.where.begin(), nb.where.end(), ';', ',');
+	AppLock l(mtx);
+	bodies[code] = nb;
+}
+
+std::string Sampler::name_of(bytecode_t const* code) const {
+	if(!code) return "[truncated]";
+	body_map::const_iterator it = bodies.find(code);
+	if(it != bodies.end()) return it->second.where;
+	std::ostringstream where;
+	where << "<unknown>@" << (void const*) code;
+	return where.str();
+}
+
+static void set_timer(size_t usec) {
+	struct itimerval it;
+	it.it_interval.tv_sec = usec / 1000000;
+	it.it_interval.tv_usec = usec % 1000000;
+	it.it_value = it.it_interval;
+	setitimer(ITIMER_PROF, &it, 0);
+}
+
+void Sampler::start(void) {
+	struct sigaction sa;
+	std::memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = &sigprof_handler;
+	/*don't make the system calls of the workers fail*/
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGPROF, &sa, 0);
+	set_timer(interval_usec ? interval_usec : 1);
+}
+
+void Sampler::stop(void) {
+	set_timer(0);
+}
+
+void Sampler::write(std::ostream& o,
+		std::vector<SampleBuffer*> const& buffers) {
+	AppLock l(mtx);
+	SampleBuffer::stack_map all;
+	size_t dropped = 0;
+	for(size_t i = 0; i < buffers.size(); ++i) {
+		SampleBuffer& sb = *buffers[i];
+		sb.drain();
+		dropped += sb.dropped;
+		for(SampleBuffer::stack_map::const_iterator it =
+				sb.stacks.begin();
+				it != sb.stacks.end(); ++it) {
+			all[it->first] += it->second;
+		}
+	}
+	for(SampleBuffer::stack_map::const_iterator it = all.begin();
+			it != all.end(); ++it) {
+		std::vector<bytecode_t const*> const& frames = it->first.second;
+		switch(it->first.first) {
+		case sample_gc:
+			o << "[gc]";
+			break;
+		case sample_scheduler:
+			o << "[scheduler]";
+			break;
+		default:
+			if(frames.empty()) o << "[vm]";
+			/*outermost continuation first*/
+			for(size_t i = frames.size(); i; --i) {
+				o << name_of(frames[i - 1]);
+				if(i != 1) o << ";";
+			}
+			break;
+		}
+		o << " " << it->second << std::endl;
+	}
+	if(dropped) {
+		std::cerr << "stack sampler: " << dropped
+			<< " samples dropped" << std::endl;
+	}
+}
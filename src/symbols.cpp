@@ -10,26 +10,20 @@
 #include<map>
 
 void Symbol::copy_value_to(ValueHolderRef& p) {
-	{AppLock l(m);
-		/*Unfortunately the entire cloning has to be
-		done while we have the lock.  This is because
-		a Symbol::set_value() might invalidate the
-		pointer from under us if we didn't do the
-		entire cloning locked.
-		Other alternatives exist: we can use a locked
-		reference counting scheme, or use some sort
-		of deferred deallocation.
-		*/
-		value->clone(p);
-	}
+	/*the snapshot can't change under us, and is kept alive
+	by our reference to it even if a Symbol::set_value()
+	replaces it while we clone, so no lock is needed
+	*/
+	boost::shared_ptr<ValueHolder const> v = boost::atomic_load(&value);
+	v->clone(p);
 }
 void Symbol::copy_value_to_and_add_notify(ValueHolderRef& p, Process* R) {
+	/*Register for notification before loading the value:
+	Symbol::set_value() publishes the new value before
+	notifying, so either we load the new value, or we are
+	notified that the one we loaded is stale.
+	*/
 	{AppLock l(m);
-	  if (value.empty()) {
-			// no value associated with this symbol
-			throw_HlError(("unbound variable: " + printname).c_str());
-		}
-		value->clone(p);
 		/*check for dead processes in notification list*/
 		size_t j = 0;
 		for(size_t i = 0; i < notification_list.size(); ++i) {
@@ -43,13 +37,23 @@ void Symbol::copy_value_to_and_add_notify(ValueHolderRef& p, Process* R) {
 		notification_list.resize(j + 1);
 		notification_list[j] = R;
 	}
+	boost::shared_ptr<ValueHolder const> v = boost::atomic_load(&value);
+	if (!v) {
+		// no value associated with this symbol
+		throw_HlError(("unbound variable: " + printname).c_str());
+	}
+	v->clone(p);
 }
 
 void Symbol::set_value(Object::ref o) {
 	ValueHolderRef tmp;
-	ValueHolder::copy_object(tmp, o);
+	/*bodies go to the code space, to be shared by every
+	process that reads this
+	*/
+	ValueHolder::copy_object(tmp, o, true);
+	boost::shared_ptr<ValueHolder const> nv(tmp.release());
+	boost::atomic_store(&value, nv);
 	{AppLock l(m);
-		value.swap(tmp);
 		size_t j = 0;
 		for(size_t i = 0; i < notification_list.size(); ++i) {
 			if(!notification_list[i]->is_dead()) {
@@ -64,11 +68,10 @@ void Symbol::set_value(Object::ref o) {
 	}
 }
 
-void Symbol::clean_notification_list(std::set<Process*> const& dead) {
+void Symbol::clean_notification_list(void) {
 	size_t j = 0;
 	for(size_t i = 0; i < notification_list.size(); ++i) {
-		/*not counted among the dead?*/
-		if(dead.count(notification_list[i]) == 0) {
+		if(!notification_list[i]->is_dead()) {
 			if(i != j) {
 				notification_list[j] = notification_list[i];
 			}
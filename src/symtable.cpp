@@ -1,22 +1,68 @@
-
 #include"all_defines.hpp"
 
 #include"symbols.hpp"
 
-Symbol* SymbolsTable::lookup(std::string x) {
-	{AppLock l(m);
-		Symbol*& s = tb[x];
-		if(s) return s;
-		s = new Symbol(x);
-		return s;
+/*FNV-1a*/
+uint32_t SymbolsTable::hash(char const* s, size_t len) {
+	uint32_t h = 2166136261u;
+	for(size_t i = 0; i < len; ++i) {
+		h ^= (unsigned char) s[i];
+		h *= 16777619u;
 	}
+	return h;
 }
 
-typedef std::map<std::string, Symbol*> maptype;
+void SymbolsTable::Shard::grow(void) {
+	std::vector<Entry> nslots(slots.size() * 2);
+	size_t mask = nslots.size() - 1;
+	for(size_t i = 0; i < slots.size(); ++i) {
+		if(!slots[i].sym) continue;
+		size_t j = slots[i].hash & mask;
+		while(nslots[j].sym) j = (j + 1) & mask;
+		nslots[j] = slots[i];
+	}
+	slots.swap(nslots);
+}
+
+Symbol* SymbolsTable::lookup(char const* s, size_t len) {
+	uint32_t h = hash(s, len);
+	/*the top bits pick the shard, the bottom bits the slot*/
+	Shard& sh = shards[h >> (32 - shard_bits)];
+	{AppLock l(sh.m);
+		size_t mask = sh.slots.size() - 1;
+		size_t i = h & mask;
+		for(;;) {
+			Entry& e = sh.slots[i];
+			if(!e.sym) break;
+			if(e.hash == h) {
+				std::string const& nm = e.sym->printname;
+				if(nm.size() == len && std::memcmp(nm.data(), s, len) == 0) {
+					return e.sym;
+				}
+			}
+			i = (i + 1) & mask;
+		}
+		Symbol* rv = new Symbol(std::string(s, len));
+		/*keep the shard at most three-quarters full*/
+		if(4 * (sh.count + 1) > 3 * sh.slots.size()) {
+			sh.grow();
+			mask = sh.slots.size() - 1;
+			i = h & mask;
+			while(sh.slots[i].sym) i = (i + 1) & mask;
+		}
+		sh.slots[i].hash = h;
+		sh.slots[i].sym = rv;
+		++sh.count;
+		return rv;
+	}
+}
 
 void SymbolsTable::traverse_symbols(SymbolsTableTraverser* stt) const {
-	for(maptype::const_iterator it = tb.begin(); it != tb.end(); ++it) {
-		stt->traverse(it->second);
+	for(size_t i = 0; i < (1 << shard_bits); ++i) {
+		std::vector<Entry> const& slots = shards[i].slots;
+		for(size_t j = 0; j < slots.size(); ++j) {
+			if(slots[j].sym) stt->traverse(slots[j].sym);
+		}
 	}
 }
 
@@ -32,4 +78,3 @@ SymbolsTable::~SymbolsTable() {
 	SymbolDeletor sd;
 	traverse_symbols(&sd);
 }
-
@@ -0,0 +1,84 @@
+#include"all_defines.hpp"
+
+#include"traces.hpp"
+#include"processes.hpp"
+
+#include<ostream>
+
+/*-----------------------------------------------------------------------------
+TraceBuffer
+-----------------------------------------------------------------------------*/
+
+static char const* status_name(int status) {
+	switch(status) {
+	case process_dead:		return "dead";
+	case process_waiting:		return "waiting";
+	case process_anesthesized:	return "anesthesized";
+	case process_running:		return "running";
+	case process_change:		return "change";
+	}
+	return "unknown";
+}
+
+static char const* source_name(int source) {
+	switch(source) {
+	case source_workqueue:	return "workqueue";
+	case source_kept:	return "kept";
+	case source_donated:	return "donated";
+	}
+	return "unknown";
+}
+
+static void write_event(std::ostream& o, TraceEvent const& e, size_t tid,
+		uint64_t base) {
+	o << ",\n{\"pid\":0,\"tid\":" << tid
+	  << ",\"ts\":" << (e.start - base);
+	switch(e.kind) {
+	case trace_slice:
+		o << ",\"ph\":\"X\",\"dur\":" << (e.end - e.start)
+		  << ",\"cat\":\"sched\",\"name\":\"execute\",\"args\":{"
+		  << "\"process\":\"" << (void*) e.P << "\""
+		  << ",\"status\":\"" << status_name(e.status) << "\""
+		  << ",\"reductions\":" << e.value
+		  << ",\"source\":\"" << source_name(e.source) << "\"";
+		if(e.source == source_workqueue) {
+			o << ",\"queue_delay_us\":" << e.delay;
+		}
+		o << "}}";
+		break;
+	case trace_donate:
+		o << ",\"ph\":\"i\",\"s\":\"t\""
+		  << ",\"cat\":\"sched\",\"name\":\"donate\",\"args\":{"
+		  << "\"from\":\"" << (void*) e.P << "\""
+		  << ",\"to\":\"" << (void*) e.Q << "\""
+		  << ",\"timeslice\":" << e.value
+		  << "}}";
+		break;
+	case trace_soft_stop:
+	case trace_gc_start:
+	case trace_gc_sweep:
+		o << ",\"ph\":\"X\",\"dur\":" << (e.end - e.start)
+		  << ",\"cat\":\"gc\",\"name\":\""
+		  << (	(e.kind == trace_soft_stop) ?	"soft-stop" :
+			(e.kind == trace_gc_start) ?	"gc-start" :
+			/*otherwise*/			"gc-sweep"	)
+		  << "\"}";
+		break;
+	}
+}
+
+void TraceBuffer::write_json(std::ostream& o, uint64_t base) const {
+	o << ",\n{\"pid\":0,\"tid\":" << id
+	  << ",\"ph\":\"M\",\"name\":\"thread_name\",\"args\":{\"name\":"
+	  << "\"worker " << id << "\"}}";
+	/*oldest events first*/
+	if(wrapped) {
+		for(size_t i = next; i < events.size(); ++i) {
+			write_event(o, events[i], id, base);
+		}
+	}
+	for(size_t i = 0; i < next; ++i) {
+		write_event(o, events[i], id, base);
+	}
+}
+
@@ -32,7 +32,7 @@ Closure* Closure::NewClosure(Heap & h, size_t n) {
   Closure *c = h.create_variadic<Closure>(n);
   c->body = Object::nil();
   c->nonreusable = true;
-  c->kontinuation.reset();
+  c->continuation = false;
   return c;
 }
 
@@ -40,7 +40,7 @@ Closure* Closure::NewKClosure(Heap & h, size_t n) {
   Closure *c = h.lifo_create_variadic<Closure>(n);
   c->body = Object::nil();
   c->nonreusable = false;
-  c->kontinuation.reset(new History::InnerRing);
+  c->continuation = true;
   return c;
 }
 
@@ -66,6 +66,13 @@ size_t hash_is(Object::ref o) {
 		tables to have more than 4,294,967,296 entries.
 		At least not *yet*.
 		*/
+		/*the low bits of an unboxed float are often all
+		zero, so fold in the high bits
+		*/
+		if(is_a<double>(o)) {
+			uint64_t b = (uint64_t) o.dat;
+			return (size_t) int_hash((uint32_t) (b ^ (b >> 32)));
+		}
 		return (size_t) int_hash((uint32_t) o.dat);
 	} else {
 		HashingClass hc;
@@ -7,12 +7,91 @@
 #include"lockeds.hpp"
 #include"symbols.hpp"
 #include"aio.hpp"
+#include"clock.hpp"
+#include"profiles.hpp"
+#include"samples.hpp"
 
 #include<boost/noncopyable.hpp>
 
 #include<iostream>
+#include<fstream>
 
 
+/*-----------------------------------------------------------------------------
+ProcessShard
+-----------------------------------------------------------------------------*/
+
+void ProcessShard::register_process(Process* P) {
+	P->is_registered = 1;
+	U.push_back(P);
+	++registered;
+	P->accounted_status = process_running;
+	++processes[process_running];
+}
+
+void ProcessShard::account(Process* P) {
+	size_t b = P->heap().used_total();
+	if(b != P->accounted_bytes) {
+		heap_bytes += (ptrdiff_t) b - (ptrdiff_t) P->accounted_bytes;
+		P->accounted_bytes = b;
+	}
+	ProcessStatus s = P->status();
+	if(s != P->accounted_status) {
+		--processes[P->accounted_status];
+		++processes[s];
+		P->accounted_status = s;
+	}
+	size_t n = P->mailbox().size();
+	if(n != P->accounted_messages) {
+		messages += (ptrdiff_t) n - (ptrdiff_t) P->accounted_messages;
+		P->accounted_messages = n;
+	}
+}
+
+size_t ProcessShard::partition(void) {
+	size_t i, j;
+	Process* tmp;
+	size_t l = U.size();
+	ptrdiff_t live_bytes = 0;
+	ptrdiff_t live_processes[process_running + 1] = {0};
+	ptrdiff_t live_messages = 0;
+	for(i = 0, j = 0; i < l; ++i) {
+		if(U[i]->is_black()) {
+			U[i]->whiten();
+			live_bytes += U[i]->accounted_bytes;
+			++live_processes[U[i]->accounted_status];
+			live_messages += U[i]->accounted_messages;
+			/*swap in order to partition
+			U into known-live and known-dead
+			*/
+			tmp = U[i];
+			U[i] = U[j];
+			U[j] = tmp;
+			++j;
+		} else {
+			U[i]->kill();
+		}
+	}
+	registered.store(0);
+	heap_bytes.store(live_bytes);
+	for(i = 0; i <= process_running; ++i) {
+		processes[i].store(live_processes[i]);
+	}
+	messages.store(live_messages);
+	return j;
+}
+
+void ProcessShard::delete_from(size_t j) {
+	for(size_t i = j; i < U.size(); ++i) {
+		delete U[i];
+	}
+	U.resize(j);
+}
+
+ProcessShard::~ProcessShard() {
+	delete_from(0);
+}
+
 /*-----------------------------------------------------------------------------
 AllWorkers
 -----------------------------------------------------------------------------*/
@@ -32,13 +111,35 @@ void AllWorkers::set_exit_condition() {
  */
 
 void AllWorkers::register_process(Process* P) {
-	AppLock l(U_mtx);
-	U.push_back(P);
+	AppLock l(general_mtx);
+	if(shards.empty()) {
+		shards.push_back(new ProcessShard());
+	}
+	shards[0]->register_process(P);
 }
 
 void AllWorkers::register_worker(Worker* W) {
 	{
 		AppLock l(general_mtx);
+		/*the shard is kept in shards even after the worker
+		unregisters, so that its processes still get swept
+		*/
+		W->shard = new ProcessShard();
+		shards.push_back(W->shard);
+		if(tracing) {
+			W->trace = new TraceBuffer(traces.size(), trace_size);
+			traces.push_back(W->trace);
+		}
+		if(profile_bytecodes) {
+			W->profile = new BytecodeProfile();
+			profiles.push_back(W->profile);
+		}
+		if(Sampler::active()) {
+			W->samples = new SampleBuffer(Sampler::buffer_size);
+			samples.push_back(W->samples);
+			/*called on the worker's own thread*/
+			SampleBuffer::attach(W->samples);
+		}
 		Ws.push_back(W);
 		total_workers++;
 		if(soft_stop_condition) {
@@ -53,6 +154,7 @@ wait:
 
 void AllWorkers::unregister_worker(Worker* W) {
 	AppLock lg(general_mtx);
+	if(W->samples) SampleBuffer::attach(0);
 	size_t l = Ws.size();
 	for(size_t i = 0; i < l; ++i) {
 		if(Ws[i] == W) {
@@ -86,6 +188,100 @@ void AllWorkers::unregister_worker(Worker* W) {
 	}
 }
 
+/*
+ * Process-level GC policy
+ */
+
+bool AllWorkers::process_gc_due(bool idle) {
+	if(!idle && ++gc_check_count < ProcessGCPolicy::check_interval) {
+		return 0;
+	}
+	gc_check_count = 0;
+	size_t registered = 0;
+	ptrdiff_t heap_bytes = 0;
+	{AppLock l(general_mtx);
+		/*general_mtx only guards the shards vector; other
+		workers may be updating their counters, so the
+		totals are slightly out of date
+		*/
+		for(size_t i = 0; i < shards.size(); ++i) {
+			registered += shards[i]->registered.load();
+			heap_bytes += shards[i]->heap_bytes.load();
+		}
+	}
+	ptrdiff_t growth = heap_bytes - (ptrdiff_t) gc_policy.live_heap_bytes;
+	if(idle) {
+		return registered > 0 || growth > 0;
+	}
+	return registered >= gc_policy.process_threshold() ||
+		growth >= (ptrdiff_t) gc_policy.heap_threshold();
+}
+
+/*
+ * Metrics
+ */
+
+bool AllWorkers::metrics_due(void) {
+	if(!metrics_interval_ms || !metrics_out) return 0;
+	uint64_t now = monotonic_usec();
+	if(now < metrics_next_usec) return 0;
+	metrics_next_usec = now + ((uint64_t) metrics_interval_ms) * 1000;
+	return 1;
+}
+
+/*a sum over shards, which may be briefly negative while
+a process moves between them
+*/
+static inline size_t nonnegative(ptrdiff_t n) {
+	return n < 0 ? 0 : (size_t) n;
+}
+
+SchedulerMetrics AllWorkers::get_metrics(void) {
+	SchedulerMetrics m;
+	ptrdiff_t processes[process_running + 1] = {0};
+	ptrdiff_t messages = 0;
+	ptrdiff_t heap_bytes = 0;
+	m.usec = monotonic_usec() - start_usec;
+	{AppLock l(general_mtx);
+		m.workqueue = workqueue.size();
+		m.waitqueue = waitqueue.size();
+		for(size_t i = 0; i < shards.size(); ++i) {
+			ProcessShard& S = *shards[i];
+			for(size_t j = 0; j <= process_running; ++j) {
+				processes[j] += S.processes[j].load();
+			}
+			messages += S.messages.load();
+			heap_bytes += S.heap_bytes.load();
+		}
+	}
+	m.running = nonnegative(processes[process_running]);
+	m.waiting = nonnegative(processes[process_waiting]);
+	m.anesthesized = nonnegative(processes[process_anesthesized]);
+	m.dead = nonnegative(processes[process_dead]);
+	m.mailbox = nonnegative(messages);
+	m.heap_bytes = nonnegative(heap_bytes);
+	m.code_bytes = code_space.used();
+	m.code_unshared = code_space.unshared();
+	return m;
+}
+
+void AllWorkers::write_metrics(void) {
+	SchedulerMetrics m = get_metrics();
+	*metrics_out
+		<< "usec=" << m.usec
+		<< " workqueue=" << m.workqueue
+		<< " waitqueue=" << m.waitqueue
+		<< " running=" << m.running
+		<< " waiting=" << m.waiting
+		<< " anesthesized=" << m.anesthesized
+		<< " dead=" << m.dead
+		<< " mailbox=" << m.mailbox
+		<< " heap_bytes=" << m.heap_bytes
+		<< " code_bytes=" << m.code_bytes
+		<< " code_unshared=" << m.code_unshared
+		<< std::endl;
+}
+
 /*
  * Soft-stop
  */
@@ -120,6 +316,7 @@ void AllWorkers::soft_stop_check(Worker* W, Process*& R) {
 	{ AppLock l(general_mtx);
 		if(soft_stop_condition) {
 			if(R) {
+				if(tracing) R->enqueued_usec = monotonic_usec();
 				workqueue.push(R);
 				R = 0;
 			}
@@ -137,7 +334,13 @@ void AllWorkers::soft_stop_check(Worker* W, Process*& R) {
 		return;
 	}
 wait:
-	W->waiting_sema.wait();
+	if(W->trace) {
+		uint64_t start = monotonic_usec();
+		W->waiting_sema.wait();
+		W->trace->span(trace_soft_stop, start, monotonic_usec());
+	} else {
+		W->waiting_sema.wait();
+	}
 	return;
 }
 
@@ -155,6 +358,7 @@ void AllWorkers::workqueue_push(Process* R) {
 	AppLock l(general_mtx);
 	bool waiting = !waitqueue.empty();
 	Process::SetOnlyRunning(R,0);
+	if(tracing) R->enqueued_usec = monotonic_usec();
 	workqueue.push(R);
 	if(waiting) {
 		Worker* W = waitqueue.front(); waitqueue.pop();
@@ -178,6 +382,7 @@ void AllWorkers::workqueue_push_and_pop(Process*& R, Worker* W) {
 			return;
 		}
 		Process::SetOnlyRunning(R,0);
+		if(tracing) R->enqueued_usec = monotonic_usec();
 		workqueue.push(R);
 		R = workqueue.front();
 		workqueue.pop();
@@ -185,7 +390,9 @@ void AllWorkers::workqueue_push_and_pop(Process*& R, Worker* W) {
 	}
 }
 bool AllWorkers::workqueue_pop(Process*& R, Worker* W) {
+	bool soft_stopped;
 start:
+	soft_stopped = 0;
 	{ AppLock l(general_mtx);
 		if(exit_condition) return 0;
 		/*we still have to check soft-stop here, because of
@@ -212,6 +419,7 @@ start:
 			if(blocked >= total_workers) {
 				soft_stop_sema.post();
 			}
+			soft_stopped = 1;
 			/*release lock and wait*/
 			goto wait;
 		}
@@ -237,7 +445,14 @@ start:
 		}
 	}
 wait:
-	W->waiting_sema.wait(); goto start;
+	if(soft_stopped && W->trace) {
+		uint64_t start = monotonic_usec();
+		W->waiting_sema.wait();
+		W->trace->span(trace_soft_stop, start, monotonic_usec());
+	} else {
+		W->waiting_sema.wait();
+	}
+	goto start;
 }
 void AllWorkers::workqueue_trypop(Process*& R) {
 	AppTryLock l(general_mtx);
@@ -276,6 +491,17 @@ void AllWorkers::workqueue_trypop(Process*& R) {
 #endif
 
 void AllWorkers::initiate(size_t nworkers, Process* begin, ValueHolderRef& rv) {
+	tracing = !trace_file.empty();
+	start_usec = monotonic_usec();
+	if(!metrics_file.empty()) {
+		metrics_out.reset(new std::ofstream(metrics_file.c_str()));
+		if(!*metrics_out) {
+			std::cerr << "Can't open metrics file: "
+				<< metrics_file << std::endl;
+			metrics_out.reset();
+		}
+	}
+	metrics_next_usec = start_usec + ((uint64_t) metrics_interval_ms) * 1000;
 	{
 		begin->is_main = 1;
 		#ifdef DEBUG
@@ -286,26 +512,88 @@ void AllWorkers::initiate(size_t nworkers, Process* begin, ValueHolderRef& rv) {
 		#endif
 		register_process(begin);
 		workqueue_push(begin);
+		if(metrics_out) write_metrics();
 		Worker W(this);
 		#ifndef single_threaded
 			for(size_t i = 1; i < nworkers; ++i) {
 				wtc.launch(W);
 			}
 		#endif
+		if(Sampler::active()) sampler.start();
 		W(1); // the 1 indicates that it is the "main" thread.
 	}
+	if(Sampler::active()) sampler.stop();
+	if(metrics_out) {
+		write_metrics();
+		metrics_out.reset();
+	}
+	if(tracing) write_trace();
+	if(profile_bytecodes) write_profile();
+	if(Sampler::active()) write_samples();
 	return_value.swap(rv);
 }
 
+void AllWorkers::write_trace(void) {
+	std::ofstream o(trace_file.c_str());
+	if(!o) {
+		std::cerr << "Can't open trace file: " << trace_file
+			<< std::endl;
+		return;
+	}
+	AppLock l(general_mtx);
+	o << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+	  << "{\"pid\":0,\"ph\":\"M\",\"name\":\"process_name\","
+	  << "\"args\":{\"name\":\"hlvma scheduler\"}}";
+	for(size_t i = 0; i < traces.size(); ++i) {
+		traces[i]->write_json(o, start_usec);
+	}
+	o << "\n]}" << std::endl;
+}
+
+void AllWorkers::write_profile(void) {
+	AppLock l(general_mtx);
+	BytecodeProfile all;
+	for(size_t i = 0; i < profiles.size(); ++i) {
+		all.merge(*profiles[i]);
+	}
+	all.report(std::cerr);
+}
+
+void AllWorkers::write_samples(void) {
+	std::ofstream o(Sampler::file.c_str());
+	if(!o) {
+		std::cerr << "Can't open sample file: " << Sampler::file
+			<< std::endl;
+		return;
+	}
+	AppLock l(general_mtx);
+	sampler.write(o, samples);
+}
+
 /*
  * constructor/destructor
  */
 AllWorkers::AllWorkers(void)
 	/*set default_timeslice to a much smaller number when testing!*/
-	: default_timeslice(1024),
-	  soft_stop_condition(0),
+	: soft_stop_condition(0),
 	  total_workers(0),
-	  return_value() {
+	  default_timeslice(1024),
+	  gc_start_usec(0),
+	  gc_check_count(0),
+	  start_usec(0),
+	  tracing(0),
+	  traces(),
+	  profiles(),
+	  samples(),
+	  metrics_next_usec(0),
+	  metrics_out(),
+	  return_value(),
+	  gc_policy(),
+	  trace_file(),
+	  trace_size(65536),
+	  profile_bytecodes(0),
+	  metrics_interval_ms(0),
+	  metrics_file() {
 }
 
 AllWorkers::~AllWorkers() {
@@ -328,8 +616,17 @@ AllWorkers::~AllWorkers() {
 			}
 		}
 	#endif
-	for(size_t i = 0; i < U.size(); ++i) {
-		delete U[i];
+	for(size_t i = 0; i < shards.size(); ++i) {
+		delete shards[i];
+	}
+	for(size_t i = 0; i < traces.size(); ++i) {
+		delete traces[i];
+	}
+	for(size_t i = 0; i < profiles.size(); ++i) {
+		delete profiles[i];
+	}
+	for(size_t i = 0; i < samples.size(); ++i) {
+		delete samples[i];
 	}
 }
 
@@ -338,10 +635,14 @@ AllWorkers::~AllWorkers() {
  */
 
 void AllWorkers::report(void) {
-	AppLock l(U_mtx);
+	AppLock l(general_mtx);
+	size_t n = 0;
+	for(size_t i = 0; i < shards.size(); ++i) {
+		n += shards[i]->U.size();
+	}
 	std::cerr
 		<< "Processes not cleaned: "
-		<< U.size()
+		<< n
 		<< std::endl;
 }
 
@@ -371,8 +672,7 @@ public:
 void Worker::operator()(bool is_main) {
 	WorkerInitTeardown wit(is_main);
 	if(is_main) {
-		// T = 4; // for testing, set to 4: future should be 16384
-		T = 16384;
+		T = 1;
 	} else {
 		T = 0;
 	}
@@ -404,16 +704,17 @@ void Worker::operator()(bool is_main) {
  * Helper RAII classes
  */
 
+/*only ever given HlPid objects, via traverse_pids*/
 class MarkingTraverser : public HeapTraverser {
 private:
-	std::set<Process*>* pgray_set;
+	std::vector<Process*>* pgray_set;
 public:
-	explicit MarkingTraverser(std::set<Process*>& ngray_set)
+	explicit MarkingTraverser(std::vector<Process*>& ngray_set)
 		: pgray_set(&ngray_set) { }
 	virtual void traverse(Generic* gp) {
-		HlPid* pp = dynamic_cast<HlPid*>(gp);
-		if(pp && pp->process->waiting_and_not_black()){
-			pgray_set->insert(pp->process);
+		HlPid* pp = static_cast<HlPid*>(gp);
+		if(pp->process->grayen_if_waiting()){
+			pgray_set->push_back(pp->process);
 		}
 	}
 };
@@ -426,7 +727,7 @@ class RunningProcessRef : boost::noncopyable {
 public:
 	Process* p;
 	RunningProcessRef(void) : p(0) { }
-	RunningProcessRef& operator=(Process* np) { p = np; }
+	RunningProcessRef& operator=(Process* np) { p = np; return *this; }
 	~RunningProcessRef() {
 		/*DON'T delete p, just kill it*/
 		if(p) p->atomic_kill();
@@ -497,8 +798,8 @@ void Worker::mark_process(Process* P) {
 	be unsafe if the process is dead.
 	*/
 	MarkingTraverser mt(gray_set);
-	P->heap().traverse_objects(&mt);
-	P->mailbox().traverse(&mt);
+	P->heap().traverse_pids(&mt);
+	P->mailbox().traverse_pids(&mt);
 
 	/*does not require atomicity, since only one
 	worker thread can perform marking on any
@@ -517,8 +818,9 @@ private:
 	size_t i;
 
 	void add(Process* pp) {
-		std::set<Process*>& gray_set = (*Wsp)[i]->gray_set;
-		gray_set.insert(pp);
+		if(!pp->grayen()) return;
+		std::vector<Process*>& gray_set = (*Wsp)[i]->gray_set;
+		gray_set.push_back(pp);
 		++i;
 		if(i >= Wsp->size()) i = 0;
 	}
@@ -529,11 +831,10 @@ private:
 	public:
 		explicit SingleSymbolScanner(SymbolProcessScanner* nparent)
 			: parent(nparent) { }
+		/*only ever given HlPid objects, via traverse_pids*/
 		void traverse(Generic* gp) {
-			HlPid* pp = dynamic_cast<HlPid*>(gp);
-			if(pp) {
-				parent->add(pp->process);
-			}
+			HlPid* pp = static_cast<HlPid*>(gp);
+			parent->add(pp->process);
 		}
 	};
 
@@ -543,28 +844,20 @@ public:
 
 	void traverse(Symbol* sp) {
 		SingleSymbolScanner sss(this);
-		sp->traverse_objects(&sss);
+		sp->traverse_pids(&sss);
 	}
 };
 
 /*
  * Scan symbols' notification lists for processes that
- * are about to be deleted.
+ * are about to be deleted.  The sweep has already killed
+ * them, so they are recognized by their dead status.
  */
 
 class SymbolNotificationCleaner : public SymbolsTableTraverser {
-private:
-	std::set<Process*> dead;
-
 public:
-	SymbolNotificationCleaner(std::vector<Process*>& U, size_t j) {
-		/*dead processes are from U[j] to U[U.size() - 1]*/
-		for(size_t i = j; i < U.size(); ++i) {
-			dead.insert(U[i]);
-		}
-	}
 	void traverse(Symbol* sp) {
-		sp->clean_notification_list(dead);
+		sp->clean_notification_list();
 	}
 };
 
@@ -581,8 +874,9 @@ public:
 		: Wsp(&Ws), i(0) { }
 
 	void traverse(ProcessInvoker const& PI) {
-		std::set<Process*>& gray_set = (*Wsp)[i]->gray_set;
-		gray_set.insert(PI.P);
+		if(!PI.P->grayen()) return;
+		std::vector<Process*>& gray_set = (*Wsp)[i]->gray_set;
+		gray_set.push_back(PI.P);
 		++i;
 		if(i >= Wsp->size()) i = 0;
 	}
@@ -598,11 +892,19 @@ void Worker::work(void) {
 	RunningProcessRef R;
 	Process* Q = 0;
 	size_t timeslice;
+	bool idle = 0;
+
+	/*for scheduler tracing*/
+	int source = source_workqueue;
+	uint64_t slice_start = 0;
+	size_t slice_budget = 0;
 
 WorkerLoop:
 	if(T) {
+		if(parent->metrics_due()) parent->write_metrics();
 		/*trigger GC*/
-		if(T == 1) {
+		if(parent->process_gc_due(idle)) {
+			parent->gc_start_usec = monotonic_usec();
 			if(R) {
 				parent->workqueue_push(R);
 				R = 0;
@@ -623,28 +925,39 @@ WorkerLoop:
 					parent->Ws[i]->in_gc = 1;
 				}
 			}
+			if(trace) {
+				trace->span(trace_gc_start,
+					parent->gc_start_usec, monotonic_usec());
+			}
 			T = 0;
-		} else {
-			--T;
 		}
 	}
 	parent->soft_stop_check(this, R);
+	source = source_workqueue;
 	if(R) {
+		Process* kept = R;
 		parent->workqueue_push_and_pop(R, this);
+		if(R == kept) source = source_kept;
 	} else {
 		if(!scanning_mode && !gray_done) {
 			parent->workqueue_trypop(R);
 			if(!R) goto gray_scan;
-		} else if(T > 0) {
-			/*just count down to the GC if we can't get any*/
+		} else if(T > 0 && !idle) {
+			/*if we can't get any, see if there's anything
+			to collect before blocking
+			*/
 			parent->workqueue_trypop(R);
-			if(!R) goto WorkerLoop;
+			if(!R) {
+				idle = 1;
+				goto WorkerLoop;
+			}
 		} else {
 			if(!parent->workqueue_pop(R, this)) {
 				return; //no more work
 			}
 		}
 	}
+	idle = 0;
 	if(scanning_mode) {
 		if(R->is_black()) {
 			scanning_mode = 0;
@@ -655,7 +968,25 @@ WorkerLoop:
 	}
 	timeslice = parent->default_timeslice;
 execute:
+	if(trace) {
+		slice_start = monotonic_usec();
+		slice_budget = timeslice;
+	}
+	R->profile = profile;
+	if(samples) samples->running = R;
 	Rstat = R->execute(timeslice, Q);
+	if(profile) profile->stop();
+	if(samples) {
+		samples->running = 0;
+		if(samples->pending()) samples->drain();
+	}
+	shard->account(R);
+	if(trace) {
+		trace->slice(slice_start, monotonic_usec(), R,
+			slice_budget - timeslice, Rstat, source,
+			(source == source_workqueue) ?
+				slice_start - R->enqueued_usec : 0);
+	}
 	/*the multipush hack: when *potentially* multiple processes must
 	be pushed onto the workqueue.
 	*/
@@ -685,9 +1016,17 @@ execute:
 		R = 0; // clear
 		break;
 	case process_change:
+		if(trace) trace->donate(monotonic_usec(), R, Q, timeslice);
+		source = source_donated;
 		parent->workqueue_push(R);
 		R = Q;
 		Q = 0;
+		/*a newly-spawned process is registered by the
+		worker that first runs it, into its own shard
+		*/
+		if(!R->is_registered) {
+			shard->register_process(R);
+		}
 		if(in_gc && !R->is_black()) {
 			mark_process(R);
 		}
@@ -701,11 +1040,9 @@ gray_scan:
 				parent->workqueue_push(R);
 				R = 0;
 			}
-			std::set<Process*>::const_iterator i;
 		get_gray:
-			i = gray_set.begin();
-			Q = *i;
-			gray_set.erase(i);
+			Q = gray_set.back();
+			gray_set.pop_back();
 			{AnesthesizeProcess ap(Q, parent);
 				if(ap.succeeded) {
 					/*NOTE! It's possible for us
@@ -740,51 +1077,56 @@ Sweep:
 		parent->workqueue_push(R);
 		R = 0;
 	}
+	if(trace) slice_start = monotonic_usec();
 	{SoftStop ss(parent);
-		size_t i, j;
-		Process* tmp;
-		std::vector<Process*>& U = parent->U;
-		size_t l = U.size();
-		for(i = 0, j = 0; i < l; ++i) {
-			if(U[i]->is_black()) {
-				U[i]->whiten();
-				/*swap in order to partition
-				U into known-live and known-dead
-				*/
-				tmp = U[i];
-				U[i] = U[j];
-				U[j] = tmp;
-				++j;
-			} else {
-				U[i]->kill();
-			}
+		size_t i;
+		std::vector<ProcessShard*>& shards = parent->shards;
+		/*index of the first dead process of each shard*/
+		std::vector<size_t> js(shards.size());
+		for(i = 0; i < shards.size(); ++i) {
+			js[i] = shards[i]->partition();
 		}
 
 		/*first clean the symbol's notification lists*/
-		SymbolNotificationCleaner snc(U, j);
+		SymbolNotificationCleaner snc;
 		symbols->traverse_symbols(&snc);
 
-		/*now really delete U[j] onwards*/
-		for(i = j; i < l; ++i) {
-			delete U[i];
+		/*now really delete the dead processes, a shard at a time*/
+		size_t died = 0;
+		size_t live = 0;
+		ptrdiff_t live_bytes = 0;
+		for(i = 0; i < shards.size(); ++i) {
+			died += shards[i]->U.size() - js[i];
+			live += js[i];
+			live_bytes += shards[i]->heap_bytes.load();
+			shards[i]->delete_from(js[i]);
 		}
-		U.resize(j);
 
 		for(i = 0; i < parent->Ws.size(); ++i) {
 			parent->Ws[i]->in_gc = 0;
 		}
 
-		size_t died = l - j;
-		/*having got the short stick, we now compute
-		the trigger point for the next GC
+		/*having got the short stick, we now become
+		the trigger for the next GC
 		*/
-		T =
-		(died >= 4096) ? 	1 :
-		/*otherwise*/		(4096 - died);
-		T += 1;
-		T *= 4;
-		// for testing, set to 4
-		// T = 4;
+		ProcessGCPolicy& policy = parent->gc_policy;
+		policy.live_processes = live;
+		policy.live_heap_bytes = live_bytes;
+		T = 1;
+
+		if(policy.report) {
+			uint64_t usec = monotonic_usec() - parent->gc_start_usec;
+			std::cerr
+				<< "process GC: reclaimed " << died
+				<< " of " << (died + live) << " processes, "
+				<< live_bytes << " heap bytes live, "
+				<< (usec / 1000) << "."
+				<< ((usec % 1000) / 100) << " ms"
+				<< std::endl;
+		}
+	}
+	if(trace) {
+		trace->span(trace_gc_sweep, slice_start, monotonic_usec());
 	}
 	goto WorkerLoop;
 }
@@ -5,13 +5,19 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <cstdlib>
 
+#include <unistd.h>
+#include <sys/wait.h>
+
 #include "reader.hpp"
 #include "executors.hpp"
 #include "symbols.hpp"
 #include "types.hpp"
 #include "assembler.hpp"
+#include "jit.hpp"
+#include "binaries.hpp"
 
 using namespace std;
 
@@ -23,7 +29,87 @@ bool GoNextBoot::run(Process& proc, size_t& reductions) {
 	throw_HlError("go-next-boot not implemented during tests");
 }
 
+// the init phase, which registers the executors
+static void init(void) {
+  initialize_globals();
+  Process p;
+  Process* Q;
+  size_t timeslice = 128;
+  execute(p, timeslice, Q, 1);
+}
+
+// assemble the code read from in and run it, leaving its result on
+// the stack
+static void run(Process & p, istream & in, bool via_hlb) {
+  read_sequence(p, in);
+  assembler.go(p);
+  if (via_hlb) {
+    std::ostringstream out;
+    write_hlb(out, *expect_type<Bytecode>(p.stack.top()));
+    p.stack.pop();
+    std::string s = out.str();
+    load_hlb(p, std::vector<char>(s.begin(), s.end()));
+  }
+  Closure *k = Closure::NewKClosure(p, 0);
+  k->codereset(p.stack.top()); p.stack.pop();
+  p.stack.push(Object::to_ref(k)); // entry point
+  Process* Q;
+  size_t timeslice = 128;
+  execute(p, timeslice, Q); // run!
+}
+
+// run the code before the "=====" line in a child, and save every
+// global it binds to img
+static bool save_first_part(string const& code, string const& img,
+                            bool via_hlb) {
+  pid_t child = fork();
+  if (child < 0)
+    return false;
+  if (child == 0) {
+    try {
+      init();
+      Process p;
+      istringstream in(code);
+      run(p, in, via_hlb);
+      save_image(img);
+    } catch (HlError& h) {
+      cerr << "Error: " << h.err_str() << endl;
+      _exit(1);
+    }
+    _exit(0);
+  }
+  int status;
+  if (waitpid(child, &status, 0) != child)
+    return false;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
 int main(int argc, char **argv) {
+  // run_bytecode [--opt-level N] [--jit-threshold N] [--via-hlb 1]
+  //              [--via-image 1] file
+  // --via-hlb 1 runs the code after writing it as .hlb and loading it
+  // --via-image 1 runs the code before a line "=====", saves every
+  // global as a boot image, and runs the code after it in a fresh VM
+  // that has loaded the image
+  bool via_hlb = false;
+  bool via_image = false;
+  while (argc >= 4) {
+    if (string(argv[1])=="--via-hlb") {
+      via_hlb = atoi(argv[2]);
+    } else if (string(argv[1])=="--via-image") {
+      via_image = atoi(argv[2]);
+    } else if (string(argv[1])=="--opt-level") {
+      assembler.opt_level = atoi(argv[2]);
+#ifdef HAVE_JIT
+    } else if (string(argv[1])=="--jit-threshold") {
+      Jit::threshold = atoi(argv[2]);
+#endif
+    } else {
+      break;
+    }
+    argv += 2;
+    argc -= 2;
+  }
   if (argc!=2) {
     cout << "Wrong number of arguments" << endl;
     return 1;
@@ -35,21 +121,41 @@ int main(int argc, char **argv) {
     return 2;
   }
 
-  initialize_globals();
+  string img, rest;
+  if (via_image) {
+    ostringstream all;
+    all << in.rdbuf();
+    string code = all.str();
+    size_t sep = code.find("\n=====\n");
+    if (sep == string::npos) {
+      cout << "No ===== line in: " << argv[1] << endl;
+      return 1;
+    }
+    img = string(argv[1]) + ".img";
+    rest = code.substr(sep + 7);
+    if (!save_first_part(code.substr(0, sep + 1), img, via_hlb)) {
+      unlink(img.c_str());
+      cout << "Couldn't save the image" << endl;
+      return 3;
+    }
+  }
 
+  init();
   Process p;
-  Process* Q;
-  size_t timeslice;
-  timeslice = 128;
-  execute(p, timeslice, Q, 1); // init phase
-
-  read_sequence(p, in);
-  assembler.go(p);
-  Closure *k = Closure::NewKClosure(p, 0);
-  k->codereset(p.stack.top()); p.stack.pop();
-  p.stack.push(Object::to_ref(k)); // entry point
-  timeslice = 128;
-  execute(p, timeslice, Q); // run!
+  if (via_image) {
+    try {
+      load_image(p, img);
+    } catch (HlError& h) {
+      unlink(img.c_str());
+      cout << "Error: " << h.err_str() << endl;
+      return 3;
+    }
+    unlink(img.c_str());
+    istringstream in_rest(rest);
+    run(p, in_rest, via_hlb);
+  } else {
+    run(p, in, via_hlb);
+  }
 
   cout << p.stack.top() << endl;
   /*